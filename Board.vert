@@ -0,0 +1,33 @@
+#version 330 core
+
+// One instance per board cell, gl_InstanceID = row * 10 + col
+layout (location = 0) in vec3 vertexPosition;
+layout (location = 1) in vec3 vertexColor;
+
+// Shared with every program through the camera's uniform buffer
+layout (std140) uniform Camera {
+    mat4 view;
+    mat4 projection;
+    mat4 viewProjection;
+};
+uniform usampler2D board; // 10x10 R8UI, non-zero where the cell exists
+uniform float baseZ;      // z of the cell before the first one
+uniform float stepZ;      // z added per cell, in row-major order
+
+// output data : used by fragment shader
+out vec3 fragColor;
+
+void main ()
+{
+    int row = gl_InstanceID / 10, col = gl_InstanceID % 10;
+    fragColor = vertexColor;
+
+    // Missing cells collapse every vertex onto one point: no fragments
+    if (texelFetch(board, ivec2(col, row), 0).r == 0u) {
+        gl_Position = vec4(0, 0, 0, 1);
+        return;
+    }
+
+    vec3 offset = vec3(col - 4, row - 5, baseZ + float(gl_InstanceID + 1) * stepZ);
+    gl_Position = viewProjection * vec4(vertexPosition + offset, 1);
+}
@@ -0,0 +1,16 @@
+#version 330 core
+
+// Flat color of the marker
+in vec3 fragColor;
+
+// output data
+out vec3 color;
+
+void main()
+{
+    // Cut the square point sprite down to the disc inscribed in it
+    vec2 p = gl_PointCoord * 2.0 - 1.0;
+    if (dot(p, p) > 1.0)
+        discard;
+    color = fragColor;
+}
@@ -0,0 +1,50 @@
+#version 330 core
+
+// No vertex attributes: the corner comes from gl_VertexID and the
+// placement from the instance buffer, two RGBA32F texels per instance:
+//   (center.xyz, zSteps) (halfSize.xyz, unused)
+// Shared with every program through the camera's uniform buffer
+layout (std140) uniform Camera {
+    mat4 view;
+    mat4 projection;
+    mat4 viewProjection;
+};
+uniform samplerBuffer instances;
+uniform int firstInstance;
+uniform bool box;        // 36 vertex box, otherwise a 6 vertex quad in its z plane
+uniform float stepZ;     // center.z moves by zSteps * stepZ
+uniform vec3 palette[6]; // one color per face for boxes, per vertex for quads
+
+// output data : used by fragment shader
+out vec3 fragColor;
+
+const vec2 QUAD[6] = vec2[](
+    vec2(-1,-1), vec2(-1, 1), vec2( 1, 1), vec2( 1, 1), vec2( 1,-1), vec2(-1,-1));
+
+// Same corner order as boxVertices(): faces -z, +z, +x, -x, +y, -y
+const vec3 BOX[36] = vec3[](
+    vec3(-1,-1,-1), vec3(-1, 1,-1), vec3( 1, 1,-1), vec3( 1, 1,-1), vec3( 1,-1,-1), vec3(-1,-1,-1),
+    vec3( 1,-1, 1), vec3( 1, 1, 1), vec3(-1, 1, 1), vec3(-1, 1, 1), vec3(-1,-1, 1), vec3( 1,-1, 1),
+    vec3( 1,-1,-1), vec3( 1, 1,-1), vec3( 1, 1, 1), vec3( 1, 1, 1), vec3( 1,-1, 1), vec3( 1,-1,-1),
+    vec3(-1,-1, 1), vec3(-1, 1, 1), vec3(-1, 1,-1), vec3(-1, 1,-1), vec3(-1,-1,-1), vec3(-1,-1, 1),
+    vec3( 1, 1, 1), vec3( 1, 1,-1), vec3(-1, 1,-1), vec3(-1, 1,-1), vec3(-1, 1, 1), vec3( 1, 1, 1),
+    vec3( 1,-1,-1), vec3( 1,-1, 1), vec3(-1,-1, 1), vec3(-1,-1, 1), vec3(-1,-1,-1), vec3( 1,-1,-1));
+
+void main ()
+{
+    int instance = 2 * (firstInstance + gl_InstanceID);
+    vec4 center = texelFetch(instances, instance);
+    vec3 halfSize = texelFetch(instances, instance + 1).xyz;
+
+    vec3 corner;
+    if (box) {
+        corner = BOX[gl_VertexID];
+        fragColor = palette[gl_VertexID / 6];
+    } else {
+        corner = vec3(QUAD[gl_VertexID], 0);
+        fragColor = palette[gl_VertexID];
+    }
+
+    vec3 position = center.xyz + vec3(0, 0, center.w * stepZ) + corner * halfSize;
+    gl_Position = viewProjection * vec4(position, 1);
+}
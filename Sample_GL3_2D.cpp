@@ -1,6 +1,17 @@
 #include <bits/stdc++.h>
 #include <cmath>
 #include <fstream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#endif
 
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
@@ -9,104 +20,1492 @@
 #include <glm/glm.hpp>
 #include <glm/gtx/transform.hpp>
 #include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/quaternion.hpp>
 
 using namespace glm;
 
+/**************************
+ * Memory accounting      *
+ **************************/
+
+/* Every heap allocation is charged to the subsystem tag current on the
+   allocating thread (set with MemoryScope) and every GL buffer or texture
+   to the tag current when it was created. Counters keep current bytes,
+   peak bytes and the number of allocations, per tag, for the heap and for
+   the GPU separately. Memory mapped files are charged to the heap side. */
+enum MemoryTag { MEM_OTHER, MEM_GEOMETRY, MEM_BOARD, MEM_SHADERS, MEM_LEVEL_PACK, MEM_PLAYOUT, MEM_FRAME, NUM_MEMORY_TAGS };
+const char *const MEMORY_TAG_NAMES[NUM_MEMORY_TAGS] = { "other", "geometry", "board", "shaders", "level_pack", "playout", "frame_arena" };
+
+struct MemoryCounters {
+  std::atomic<int64_t> current, peak;
+  std::atomic<uint64_t> allocations;
+  uint64_t frame_start; // allocations at the start of the frame (render thread)
+  uint64_t last_frame;  // allocations during the last complete frame
+};
+
+MemoryCounters heap_memory[NUM_MEMORY_TAGS], gpu_memory[NUM_MEMORY_TAGS];
+thread_local MemoryTag memory_tag = MEM_OTHER;
+
+// --check-frame-allocs: heap allocations made while draw() runs
+thread_local bool counting_draw_allocations = false;
+thread_local uint64_t draw_allocations = 0;
+
+/* Charges allocations on this thread to tag for the enclosing scope */
+struct MemoryScope {
+  MemoryTag saved;
+  MemoryScope (MemoryTag tag) : saved(memory_tag) { memory_tag = tag; }
+  ~MemoryScope () { memory_tag = saved; }
+};
+
+// Adjust current bytes (by a negative amount to shrink) and the peak
+void countBytes (MemoryCounters &counters, int64_t bytes)
+{
+  int64_t now = counters.current.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+  int64_t peak = counters.peak.load(std::memory_order_relaxed);
+  while (now > peak && !counters.peak.compare_exchange_weak(peak, now, std::memory_order_relaxed))
+    ;
+}
+
+void countAllocation (MemoryCounters &counters, int64_t bytes)
+{
+  countBytes(counters, bytes);
+  counters.allocations.fetch_add(1, std::memory_order_relaxed);
+}
+
+void countFree (MemoryCounters &counters, int64_t bytes)
+{
+  counters.current.fetch_sub(bytes, std::memory_order_relaxed);
+}
+
+/* Heap blocks carry their size and tag in front, so a free is charged
+   back to the tag that allocated the block, whichever thread frees it */
+struct alignas(std::max_align_t) HeapHeader {
+  size_t size;
+  MemoryTag tag;
+};
+
+void *trackedAlloc (size_t size)
+{
+  HeapHeader *header = (HeapHeader *) malloc(sizeof(HeapHeader) + size);
+  if (!header)
+    return NULL;
+  header->size = size;
+  header->tag = memory_tag;
+  countAllocation(heap_memory[header->tag], size);
+  if (counting_draw_allocations)
+    draw_allocations++;
+  return header + 1;
+}
+
+void trackedFree (void *p)
+{
+  if (!p)
+    return;
+  HeapHeader *header = (HeapHeader *) p - 1;
+  countFree(heap_memory[header->tag], header->size);
+  free(header);
+}
+
+void *operator new (size_t size)
+{
+  void *p = trackedAlloc(size);
+  if (!p)
+    throw std::bad_alloc();
+  return p;
+}
+void *operator new[] (size_t size) { return operator new(size); }
+void *operator new (size_t size, const std::nothrow_t &) noexcept { return trackedAlloc(size); }
+void *operator new[] (size_t size, const std::nothrow_t &) noexcept { return trackedAlloc(size); }
+void operator delete (void *p) noexcept { trackedFree(p); }
+void operator delete[] (void *p) noexcept { trackedFree(p); }
+void operator delete (void *p, size_t) noexcept { trackedFree(p); }
+void operator delete[] (void *p, size_t) noexcept { trackedFree(p); }
+void operator delete (void *p, const std::nothrow_t &) noexcept { trackedFree(p); }
+void operator delete[] (void *p, const std::nothrow_t &) noexcept { trackedFree(p); }
+
+/* Call at every frame boundary on the render thread */
+void beginMemoryFrame ()
+{
+  for (int tag = 0; tag < NUM_MEMORY_TAGS; tag++) {
+    MemoryCounters *sides[2] = { &heap_memory[tag], &gpu_memory[tag] };
+    for (int side = 0; side < 2; side++) {
+      uint64_t allocations = sides[side]->allocations.load(std::memory_order_relaxed);
+      sides[side]->last_frame = allocations - sides[side]->frame_start;
+      sides[side]->frame_start = allocations;
+    }
+  }
+}
+
+void reportMemoryUsage ()
+{
+  printf("%-11s %12s %12s %10s %7s %12s %12s %7s\n", "memory", "heap bytes", "heap peak", "allocs", "/frame",
+         "gpu bytes", "gpu peak", "/frame");
+  for (int tag = 0; tag < NUM_MEMORY_TAGS; tag++)
+    printf("%-11s %12lld %12lld %10llu %7llu %12lld %12lld %7llu\n", MEMORY_TAG_NAMES[tag],
+           (long long) heap_memory[tag].current.load(), (long long) heap_memory[tag].peak.load(),
+           (unsigned long long) heap_memory[tag].allocations.load(), (unsigned long long) heap_memory[tag].last_frame,
+           (long long) gpu_memory[tag].current.load(), (long long) gpu_memory[tag].peak.load(),
+           (unsigned long long) gpu_memory[tag].last_frame);
+}
+
+/* The same figures as a JSON object, for benchmark reports */
+void writeMemoryJson (FILE *out, const char *indent)
+{
+  fprintf(out, "{\n");
+  for (int tag = 0; tag < NUM_MEMORY_TAGS; tag++)
+    fprintf(out, "%s  \"%s\": { \"heap_bytes\": %lld, \"heap_peak\": %lld, \"heap_allocations\": %llu, "
+            "\"heap_allocations_last_frame\": %llu, "
+            "\"gpu_bytes\": %lld, \"gpu_peak\": %lld, \"gpu_allocations\": %llu, "
+            "\"gpu_allocations_last_frame\": %llu }%s\n",
+            indent, MEMORY_TAG_NAMES[tag],
+            (long long) heap_memory[tag].current.load(), (long long) heap_memory[tag].peak.load(),
+            (unsigned long long) heap_memory[tag].allocations.load(),
+            (unsigned long long) heap_memory[tag].last_frame,
+            (long long) gpu_memory[tag].current.load(), (long long) gpu_memory[tag].peak.load(),
+            (unsigned long long) gpu_memory[tag].allocations.load(),
+            (unsigned long long) gpu_memory[tag].last_frame,
+            tag + 1 < NUM_MEMORY_TAGS ? "," : "");
+  fprintf(out, "%s}", indent);
+}
+
+/**************************
+ * Frame arena            *
+ **************************/
+
+/* Transient per-frame data is bump allocated from one block and dropped
+   wholesale by reset() at the end of the frame. A frame that outgrows the
+   block continues in overflow blocks, which stay pooled for reuse; the
+   next reset then grows the main block to that frame's total, so steady
+   state frames touch neither the heap nor the pool. */
+class FrameArena {
+  std::vector<char> block;
+  size_t used;
+  std::vector<std::vector<char> > overflow; // pooled overflow blocks
+  size_t overflow_block, overflow_used;     // block in use (+1, 0 = none) and bytes used in it
+  size_t frame_bytes;                       // everything asked for this frame, with padding
+
+  static size_t alignUp (size_t offset, size_t align) { return (offset + align - 1) & ~(align - 1); }
+
+public:
+  FrameArena () : used(0), overflow_block(0), overflow_used(0), frame_bytes(0) {}
+
+  void *allocate (size_t size, size_t align)
+  {
+    size_t offset = alignUp(used, align);
+    frame_bytes += size + align - 1;
+    if (offset + size <= block.size()) {
+      used = offset + size;
+      return &block[offset];
+    }
+    // Overflow: next fit in the current pooled block, then the next pooled
+    // block big enough, then a new one
+    if (overflow_block) {
+      offset = alignUp(overflow_used, align);
+      if (offset + size <= overflow[overflow_block - 1].size()) {
+        overflow_used = offset + size;
+        return &overflow[overflow_block - 1][offset];
+      }
+    }
+    while (overflow_block < overflow.size() && overflow[overflow_block].size() < size + align)
+      overflow_block++;
+    if (overflow_block == overflow.size()) {
+      MemoryScope memory_scope(MEM_FRAME);
+      overflow.push_back(std::vector<char>(std::max(size + align, block.size() + 4096)));
+    }
+    std::vector<char> &spill = overflow[overflow_block++];
+    offset = alignUp((size_t) &spill[0], align) - (size_t) &spill[0];
+    overflow_used = offset + size;
+    return &spill[offset];
+  }
+
+  template<class T>
+  T *allocate (size_t count)
+  {
+    return (T *) allocate(count * sizeof(T), alignof(T));
+  }
+
+  void reset ()
+  {
+    if (frame_bytes > block.size()) {
+      MemoryScope memory_scope(MEM_FRAME);
+      size_t size = 4096;
+      while (size < frame_bytes)
+        size *= 2;
+      std::vector<char>(size).swap(block);
+    }
+    used = 0;
+    overflow_block = overflow_used = 0;
+    frame_bytes = 0;
+  }
+
+  size_t capacity () const { return block.size(); }
+} frame_arena;
+
+/**************************
+ * GPU resources          *
+ **************************/
+
+/* Every GL object the game creates lives in a slot of a pool; the rest of
+   the code holds a Handle, the slot index plus the slot's generation when
+   the handle was issued. Releasing a slot deletes the GL object and bumps
+   the generation, so a stale handle resolves to nothing instead of to
+   whatever reuses the slot. */
+template<class T>
+struct Handle {
+  uint32_t index;
+  uint32_t generation; // never 0 for an issued handle: a zeroed Handle is null
+  explicit operator bool () const { return generation != 0; }
+};
+
+template<class T>
+class SlotPool {
+  struct Slot {
+    uint32_t generation;
+    bool live;
+    T value;
+  };
+  std::vector<Slot> slots;
+  std::vector<uint32_t> free_slots;
+
+public:
+  Handle<T> insert (const T &value)
+  {
+    uint32_t index;
+    if (free_slots.empty()) {
+      index = slots.size();
+      Slot slot = { 1, false, value };
+      slots.push_back(slot);
+    }
+    else {
+      index = free_slots.back();
+      free_slots.pop_back();
+    }
+    slots[index].live = true;
+    slots[index].value = value;
+    Handle<T> handle = { index, slots[index].generation };
+    return handle;
+  }
+
+  T *get (Handle<T> handle)
+  {
+    if (handle.index >= slots.size() || !slots[handle.index].live || slots[handle.index].generation != handle.generation)
+      return NULL;
+    return &slots[handle.index].value;
+  }
+
+  // Copies the value out and retires the slot; false for a stale handle
+  bool erase (Handle<T> handle, T &value)
+  {
+    T *live = get(handle);
+    if (!live)
+      return false;
+    value = *live;
+    Slot &slot = slots[handle.index];
+    slot.live = false;
+    if (++slot.generation == 0)
+      slot.generation = 1;
+    free_slots.push_back(handle.index);
+    return true;
+  }
+
+  template<class F>
+  void forEach (F f)
+  {
+    for (uint32_t i = 0; i < slots.size(); i++)
+      if (slots[i].live) {
+        Handle<T> handle = { i, slots[i].generation };
+        f(handle, slots[i].value);
+      }
+  }
+};
+
+enum GpuKind { GPU_BUFFER, GPU_VERTEX_ARRAY, GPU_TEXTURE, GPU_PROGRAM, NUM_GPU_KINDS };
+const char *const GPU_KIND_NAMES[NUM_GPU_KINDS] = { "buffers", "vertex arrays", "textures", "programs" };
+
+struct GpuObject {
+  GpuKind kind;
+  GLuint name;
+  size_t bytes; // storage we allocated for it, 0 where GL does not say
+  MemoryTag tag;
+};
+typedef Handle<GpuObject> GpuHandle;
+
+SlotPool<GpuObject> gpu_objects;
+
+/* Take ownership of an existing GL object */
+GpuHandle gpuAdopt (GpuKind kind, GLuint name, size_t bytes=0)
+{
+  GpuObject object = { kind, name, bytes, memory_tag };
+  countAllocation(gpu_memory[object.tag], bytes);
+  return gpu_objects.insert(object);
+}
+
+GpuHandle gpuCreate (GpuKind kind)
+{
+  GLuint name = 0;
+  switch (kind) {
+    case GPU_BUFFER: glGenBuffers(1, &name); break;
+    case GPU_VERTEX_ARRAY: glGenVertexArrays(1, &name); break;
+    case GPU_TEXTURE: glGenTextures(1, &name); break;
+    case GPU_PROGRAM: name = glCreateProgram(); break;
+    default: break;
+  }
+  return gpuAdopt(kind, name);
+}
+
+/* GL name behind a handle, 0 if it has been released */
+GLuint gpuName (GpuHandle handle)
+{
+  GpuObject *object = gpu_objects.get(handle);
+  return object ? object->name : 0;
+}
+
+/* Record the storage size of a texture or the like */
+void gpuSetBytes (GpuHandle handle, size_t bytes)
+{
+  GpuObject *object = gpu_objects.get(handle);
+  if (object) {
+    countBytes(gpu_memory[object->tag], (int64_t) bytes - (int64_t) object->bytes);
+    object->bytes = bytes;
+  }
+}
+
+/* glBufferData that keeps the byte count; leaves the buffer bound to target */
+void gpuBufferData (GpuHandle buffer, GLenum target, size_t bytes, const void *data, GLenum usage)
+{
+  glBindBuffer(target, gpuName(buffer));
+  glBufferData(target, bytes, data, usage);
+  gpuSetBytes(buffer, bytes);
+}
+
+/* Delete the GL object and null the handle; stale handles are ignored */
+void gpuRelease (GpuHandle &handle)
+{
+  GpuObject object;
+  if (gpu_objects.erase(handle, object)) {
+    countFree(gpu_memory[object.tag], object.bytes);
+    switch (object.kind) {
+      case GPU_BUFFER: glDeleteBuffers(1, &object.name); break;
+      case GPU_VERTEX_ARRAY: glDeleteVertexArrays(1, &object.name); break;
+      case GPU_TEXTURE: glDeleteTextures(1, &object.name); break;
+      case GPU_PROGRAM: glDeleteProgram(object.name); break;
+      default: break;
+    }
+  }
+  handle = GpuHandle();
+}
+
+size_t gpuLiveBytes ()
+{
+  size_t bytes = 0;
+  gpu_objects.forEach([&] (GpuHandle, const GpuObject &object) { bytes += object.bytes; });
+  return bytes;
+}
+
+/* One vertex of interleaved geometry, as stored in level packs and in the
+   shared vertex buffer */
+struct MeshVertex {
+  GLfloat position[3];
+  GLfloat color[3];
+};
+
+/* A mesh is a range of the shared vertex buffer and a range of the shared
+   index buffer; indices are relative to BaseVertex */
 struct VAO {
-  GLuint VertexArrayID;
-  GLuint VertexBuffer;
-  GLuint ColorBuffer;
+  GLint BaseVertex;
+  GLuint FirstIndex;
 
   GLenum PrimitiveMode;
   GLenum FillMode;
   int NumVertices;
+  int NumIndices;
 };
 typedef struct VAO VAO;
 
+/* First fit free list over [0, capacity) units. Free blocks are kept by
+   offset and merged with their neighbours on release, so fragmentation
+   only comes from live allocations. */
+class RangeAllocator {
+  std::map<uint32_t, uint32_t> free_blocks; // offset -> size
+  uint32_t capacity_, used_, allocations_;
+
+  void insertFree (uint32_t offset, uint32_t size)
+  {
+    std::map<uint32_t, uint32_t>::iterator next = free_blocks.lower_bound(offset);
+    if (next != free_blocks.end() && offset + size == next->first) {
+      size += next->second;
+      next = free_blocks.erase(next);
+    }
+    if (next != free_blocks.begin()) {
+      std::map<uint32_t, uint32_t>::iterator prev = next;
+      --prev;
+      if (prev->first + prev->second == offset) {
+        prev->second += size;
+        return;
+      }
+    }
+    free_blocks[offset] = size;
+  }
+
+public:
+  RangeAllocator () : capacity_(0), used_(0), allocations_(0) {}
+
+  bool allocate (uint32_t size, uint32_t &offset)
+  {
+    for (std::map<uint32_t, uint32_t>::iterator it = free_blocks.begin(); it != free_blocks.end(); ++it) {
+      if (it->second < size)
+        continue;
+      offset = it->first;
+      uint32_t remaining = it->second - size;
+      free_blocks.erase(it);
+      if (remaining)
+        free_blocks[offset + size] = remaining;
+      used_ += size;
+      allocations_++;
+      return true;
+    }
+    return false;
+  }
+
+  void release (uint32_t offset, uint32_t size)
+  {
+    if (!size)
+      return;
+    used_ -= size;
+    allocations_--;
+    insertFree(offset, size);
+  }
+
+  // Append [capacity, new_capacity) as free space
+  void grow (uint32_t new_capacity)
+  {
+    insertFree(capacity_, new_capacity - capacity_);
+    capacity_ = new_capacity;
+  }
+
+  void reset ()
+  {
+    free_blocks.clear();
+    capacity_ = used_ = allocations_ = 0;
+  }
+
+  uint32_t capacity () const { return capacity_; }
+  uint32_t used () const { return used_; }
+  uint32_t allocations () const { return allocations_; }
+  size_t freeBlocks () const { return free_blocks.size(); }
+  uint32_t largestFree () const
+  {
+    uint32_t largest = 0;
+    for (std::map<uint32_t, uint32_t>::const_iterator it = free_blocks.begin(); it != free_blocks.end(); ++it)
+      largest = std::max(largest, it->second);
+    return largest;
+  }
+};
+
+/* All static geometry shares one VAO, one vertex buffer and one index
+   buffer, so drawing any mesh is glDrawElementsBaseVertex with no buffer
+   or VAO switch. The buffers double (with a GPU side copy) when full. */
+struct SharedGeometry {
+  GpuHandle vertex_array, vertex_buffer, index_buffer;
+  RangeAllocator vertices, indices; // in vertices and in indices
+} geometry;
+
+const uint32_t GEOMETRY_INITIAL_VERTICES = 1024, GEOMETRY_INITIAL_INDICES = 2048;
+
+GLuint bound_vertex_array; // skip rebinding the VAO between draws
+
+void bindVertexArray (GLuint name)
+{
+  if (name != bound_vertex_array) {
+    glBindVertexArray(name);
+    bound_vertex_array = name;
+  }
+}
+
+/* Point the shared VAO at the current buffers */
+void setupGeometryVertexArray ()
+{
+  bindVertexArray(gpuName(geometry.vertex_array));
+  glBindBuffer(GL_ARRAY_BUFFER, gpuName(geometry.vertex_buffer));
+  glEnableVertexAttribArray(0);
+  glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(MeshVertex), (void*)offsetof(MeshVertex, position));
+  glEnableVertexAttribArray(1);
+  glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(MeshVertex), (void*)offsetof(MeshVertex, color));
+  // The element buffer binding is part of the VAO state
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, gpuName(geometry.index_buffer));
+}
+
+/* Replace buffer by one of new_bytes holding its first old_bytes */
+void growSharedBuffer (GpuHandle &buffer, size_t old_bytes, size_t new_bytes)
+{
+  GpuHandle grown = gpuCreate(GPU_BUFFER);
+  gpuBufferData(grown, GL_COPY_WRITE_BUFFER, new_bytes, NULL, GL_STATIC_DRAW);
+  if (old_bytes) {
+    glBindBuffer(GL_COPY_READ_BUFFER, gpuName(buffer));
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, old_bytes);
+  }
+  gpuRelease(buffer);
+  buffer = grown;
+}
+
+/* Make room for at least `vertices` more vertices and `indices` more indices */
+void reserveGeometry (uint32_t vertices, uint32_t indices)
+{
+  if (!gpuName(geometry.vertex_array))
+    geometry.vertex_array = gpuCreate(GPU_VERTEX_ARRAY);
+  bool changed = false;
+  // Appending at least the request always makes room in one step
+  if (geometry.vertices.largestFree() < vertices) {
+    uint32_t capacity = geometry.vertices.capacity();
+    uint32_t grown = std::max(GEOMETRY_INITIAL_VERTICES, std::max(2 * capacity, capacity + vertices));
+    growSharedBuffer(geometry.vertex_buffer, capacity * sizeof(MeshVertex), grown * sizeof(MeshVertex));
+    geometry.vertices.grow(grown);
+    changed = true;
+  }
+  if (geometry.indices.largestFree() < indices) {
+    uint32_t capacity = geometry.indices.capacity();
+    uint32_t grown = std::max(GEOMETRY_INITIAL_INDICES, std::max(2 * capacity, capacity + indices));
+    growSharedBuffer(geometry.index_buffer, capacity * sizeof(GLuint), grown * sizeof(GLuint));
+    geometry.indices.grow(grown);
+    changed = true;
+  }
+  if (changed)
+    setupGeometryVertexArray();
+}
+
+/* Copy a mesh into the shared buffers; indices are relative to its first vertex */
+void allocateGeometry (VAO &vao, const MeshVertex *vertex_data, const GLuint *index_data)
+{
+  uint32_t base_vertex, first_index;
+  reserveGeometry(vao.NumVertices, vao.NumIndices);
+  geometry.vertices.allocate(vao.NumVertices, base_vertex);
+  geometry.indices.allocate(vao.NumIndices, first_index);
+  vao.BaseVertex = base_vertex;
+  vao.FirstIndex = first_index;
+
+  glBindBuffer(GL_COPY_WRITE_BUFFER, gpuName(geometry.vertex_buffer));
+  glBufferSubData(GL_COPY_WRITE_BUFFER, base_vertex * sizeof(MeshVertex), vao.NumVertices * sizeof(MeshVertex), vertex_data);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, gpuName(geometry.index_buffer));
+  glBufferSubData(GL_COPY_WRITE_BUFFER, first_index * sizeof(GLuint), vao.NumIndices * sizeof(GLuint), index_data);
+}
+
+void printGeometryStats ()
+{
+  const RangeAllocator *pools[2] = { &geometry.vertices, &geometry.indices };
+  const char *names[2] = { "vertices", "indices" };
+  for (int i = 0; i < 2; i++) {
+    const RangeAllocator &pool = *pools[i];
+    uint32_t free_units = pool.capacity() - pool.used();
+    double fragmentation = free_units ? 1.0 - (double) pool.largestFree() / free_units : 0.0;
+    printf("Shared %-8s %6u / %6u used by %u meshes, %zu free blocks, largest %u, fragmentation %.1f%%\n",
+           names[i], pool.used(), pool.capacity(), pool.allocations(), pool.freeBlocks(), pool.largestFree(),
+           100 * fragmentation);
+  }
+}
+
+/* Meshes are pooled like the GL objects and own their geometry ranges */
+typedef Handle<VAO> MeshHandle;
+SlotPool<VAO> meshes;
+
+void releaseMesh (MeshHandle &handle)
+{
+  VAO vao;
+  if (meshes.erase(handle, vao)) {
+    geometry.vertices.release(vao.BaseVertex, vao.NumVertices);
+    geometry.indices.release(vao.FirstIndex, vao.NumIndices);
+  }
+  handle = MeshHandle();
+}
+
+/* Live GL objects and bytes per kind, and shared geometry usage; the M key
+   prints this while playing */
+void reportGpuResources ()
+{
+  size_t count[NUM_GPU_KINDS] = {}, bytes[NUM_GPU_KINDS] = {};
+  gpu_objects.forEach([&] (GpuHandle, const GpuObject &object) {
+    count[object.kind]++;
+    bytes[object.kind] += object.bytes;
+  });
+  printf("GPU resources: %zu bytes live\n", gpuLiveBytes());
+  for (int kind = 0; kind < NUM_GPU_KINDS; kind++)
+    printf("  %-13s %4zu  %8zu bytes\n", GPU_KIND_NAMES[kind], count[kind], bytes[kind]);
+  printGeometryStats();
+}
+
+/* Report what is still alive, then release everything while the context
+   still exists */
+void releaseGpuResources ()
+{
+  reportGpuResources();
+
+  std::vector<MeshHandle> live_meshes;
+  meshes.forEach([&] (MeshHandle handle, const VAO &) { live_meshes.push_back(handle); });
+  for (size_t i = 0; i < live_meshes.size(); i++)
+    releaseMesh(live_meshes[i]);
+  std::vector<GpuHandle> live_objects;
+  gpu_objects.forEach([&] (GpuHandle handle, const GpuObject &) { live_objects.push_back(handle); });
+  for (size_t i = 0; i < live_objects.size(); i++)
+    gpuRelease(live_objects[i]);
+  geometry.vertices.reset();
+  geometry.indices.reset();
+  bound_vertex_array = 0;
+}
+
 struct GLMatrices {
-	glm::mat4 projection;
 	glm::mat4 model;
-	glm::mat4 view;
 	GLuint MatrixID;
 } Matrices;
 
-GLuint programID;
+/* View and projection with dirty flags: setters only mark what changed
+   and the derived matrices are rebuilt on the next read. All three are
+   shared with the programs through the std140 "Camera" uniform block at
+   CAMERA_UBO_BINDING, re-uploaded only when they changed. */
+const GLuint CAMERA_UBO_BINDING = 0;
+
+struct CameraBlock { // matches the Camera block in the shaders
+  glm::mat4 view;
+  glm::mat4 projection;
+  glm::mat4 view_projection;
+};
+
+struct Camera {
+  glm::vec3 eye, target, up;
+  float fov, aspect, near_plane, far_plane;
+  CameraBlock matrices;
+  bool view_dirty, projection_dirty, ubo_dirty;
+  uint64_t version; // bumped whenever view_projection changes
+  GpuHandle ubo;
+
+  Camera () : eye(0, 0, 1), target(0, 0, 0), up(0, 1, 0), fov(1), aspect(1), near_plane(.1f), far_plane(100),
+              view_dirty(true), projection_dirty(true), ubo_dirty(true), version(0) {}
+
+  void lookAt (const glm::vec3 &new_eye, const glm::vec3 &new_target, const glm::vec3 &new_up)
+  {
+    if (new_eye == eye && new_target == target && new_up == up)
+      return;
+    eye = new_eye;
+    target = new_target;
+    up = new_up;
+    view_dirty = true;
+  }
+
+  void perspective (float new_fov, float new_aspect, float new_near, float new_far)
+  {
+    if (new_fov == fov && new_aspect == aspect && new_near == near_plane && new_far == far_plane)
+      return;
+    fov = new_fov;
+    aspect = new_aspect;
+    near_plane = new_near;
+    far_plane = new_far;
+    projection_dirty = true;
+  }
+
+  const CameraBlock &update ()
+  {
+    if (view_dirty)
+      matrices.view = glm::lookAt(eye, target, up);
+    if (projection_dirty)
+      matrices.projection = glm::perspective(fov, aspect, near_plane, far_plane);
+    if (view_dirty || projection_dirty) {
+      matrices.view_projection = matrices.projection * matrices.view;
+      ubo_dirty = true;
+      version++;
+    }
+    view_dirty = projection_dirty = false;
+    return matrices;
+  }
+
+  // Push changed matrices to the uniform buffer, creating it on first use
+  void upload ()
+  {
+    update();
+    if (!gpuName(ubo)) {
+      MemoryScope memory_scope(MEM_OTHER);
+      ubo = gpuCreate(GPU_BUFFER);
+      gpuBufferData(ubo, GL_UNIFORM_BUFFER, sizeof(CameraBlock), NULL, GL_DYNAMIC_DRAW);
+      glBindBufferBase(GL_UNIFORM_BUFFER, CAMERA_UBO_BINDING, gpuName(ubo));
+      ubo_dirty = true;
+    }
+    if (!ubo_dirty)
+      return;
+    glBindBuffer(GL_UNIFORM_BUFFER, gpuName(ubo));
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(CameraBlock), &matrices);
+    ubo_dirty = false;
+  }
+} camera;
+
+/* Attach a program's Camera block, if it has one, to the shared buffer */
+void bindCameraBlock (GLuint program)
+{
+  GLuint index = glGetUniformBlockIndex(program, "Camera");
+  if (index != GL_INVALID_INDEX)
+    glUniformBlockBinding(program, index, CAMERA_UBO_BINDING);
+}
+
+GpuHandle main_program;
+
+/* Startup phase timing for --startup-report. Times are measured from
+   static initialisation, which is as close to process start as we get. */
+const std::chrono::steady_clock::time_point process_start = std::chrono::steady_clock::now();
+const char *startup_report_path = NULL; // "-" for stdout
+
+double sinceProcessStart ()
+{
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - process_start).count();
+}
+
+struct StartupPhase {
+  const char *name;
+  double start, end;
+};
+std::vector<StartupPhase> startup_phases;
+
+/* Records the lifetime of the enclosing scope as one startup phase */
+struct PhaseTimer {
+  StartupPhase phase;
+  PhaseTimer (const char *name) { phase.name = name; phase.start = sinceProcessStart(); }
+  ~PhaseTimer ()
+  {
+    if (!startup_report_path)
+      return;
+    phase.end = sinceProcessStart();
+    startup_phases.push_back(phase);
+  }
+};
+
+/* Write the collected phases as JSON once the first frame is presented */
+void writeStartupReport (double first_frame)
+{
+  FILE *out = strcmp(startup_report_path, "-") ? fopen(startup_report_path, "w") : stdout;
+  if (!out) {
+    fprintf(stderr, "Cannot write startup report to %s\n", startup_report_path);
+    return;
+  }
+  fprintf(out, "{\n  \"first_frame_ms\": %.3f,\n  \"phases\": [\n", 1000 * first_frame);
+  for (size_t i = 0; i < startup_phases.size(); i++)
+    fprintf(out, "    { \"name\": \"%s\", \"start_ms\": %.3f, \"duration_ms\": %.3f }%s\n",
+            startup_phases[i].name, 1000 * startup_phases[i].start,
+            1000 * (startup_phases[i].end - startup_phases[i].start),
+            i + 1 < startup_phases.size() ? "," : "");
+  fprintf(out, "  ]\n}\n");
+  if (out != stdout)
+    fclose(out);
+  else
+    fflush(out);
+}
+
+/* Frame pacing, chosen with --pacing:
+     vsync     swap interval 1 (the default for interactive sessions)
+     adaptive  swap interval -1 where the driver supports tearing late
+               frames instead of waiting a whole extra refresh
+     uncapped  swap interval 0, no waiting (the default for --bench-frames)
+     limit:FPS swap interval 0 and pace to FPS in software: sleep until
+               shortly before the deadline, then yield until it passes.
+               The yielding window tracks how late sleeps wake up, so the
+               limiter stays precise without spinning a core.
+   Present-to-present frame times are kept as a running mean and variance
+   and reported at exit and in the benchmark JSON. */
+enum PacingMode { PACING_VSYNC, PACING_ADAPTIVE, PACING_UNCAPPED, PACING_LIMIT };
+const char *const PACING_NAMES[] = { "vsync", "adaptive", "uncapped", "limit" };
+
+struct FramePacer {
+  int mode;
+  bool mode_set;       // given on the command line
+  double target_fps;
+  double next_frame;   // limiter deadline, glfwGetTime() seconds
+  double sleep_slack;  // how long before the deadline to stop sleeping
+  double last_present;
+  long frames;         // frame time statistics (Welford)
+  double mean_ms, m2, min_ms, max_ms;
+
+  FramePacer () : mode(PACING_VSYNC), mode_set(false), target_fps(60), next_frame(0), sleep_slack(.002),
+                  last_present(0), frames(0), mean_ms(0), m2(0), min_ms(0), max_ms(0) {}
+
+  double variance () const { return frames > 1 ? m2 / (frames - 1) : 0; }
+
+  void record (double now)
+  {
+    if (last_present > 0) {
+      double ms = 1000 * (now - last_present);
+      frames++;
+      double delta = ms - mean_ms;
+      mean_ms += delta / frames;
+      m2 += delta * (ms - mean_ms);
+      min_ms = frames == 1 ? ms : std::min(min_ms, ms);
+      max_ms = std::max(max_ms, ms);
+    }
+    last_present = now;
+  }
+
+  // Sleep, then yield, until the next deadline; a frame that ran late
+  // starts a new schedule rather than rushing to catch up
+  void limit ()
+  {
+    double period = 1 / target_fps;
+    double now = glfwGetTime();
+    next_frame += period;
+    if (next_frame < now)
+      next_frame = now;
+    double remaining = next_frame - now;
+    if (remaining > sleep_slack) {
+      double woke_early = next_frame - sleep_slack;
+      std::this_thread::sleep_for(std::chrono::duration<double>(remaining - sleep_slack));
+      double overshoot = glfwGetTime() - woke_early;
+      sleep_slack = std::min(.004, std::max(.0005, .9 * sleep_slack + .1 * 2 * overshoot));
+    }
+    while (glfwGetTime() < next_frame)
+      std::this_thread::yield();
+  }
+} pacer;
+
+/* Parse a --pacing value; returns false if it is not one */
+bool parsePacing (const char *value)
+{
+  if (!strncmp(value, "limit:", 6)) {
+    pacer.target_fps = atof(value + 6);
+    if (pacer.target_fps <= 0)
+      return false;
+    pacer.mode = PACING_LIMIT;
+  }
+  else if (!strcmp(value, "vsync"))
+    pacer.mode = PACING_VSYNC;
+  else if (!strcmp(value, "adaptive"))
+    pacer.mode = PACING_ADAPTIVE;
+  else if (!strcmp(value, "uncapped"))
+    pacer.mode = PACING_UNCAPPED;
+  else
+    return false;
+  pacer.mode_set = true;
+  return true;
+}
+
+/* Set the swap interval for the pacing mode; needs a current context */
+void applyPacing ()
+{
+  if (pacer.mode == PACING_ADAPTIVE && !glfwExtensionSupported("GLX_EXT_swap_control_tear")
+      && !glfwExtensionSupported("WGL_EXT_swap_control_tear")) {
+    printf("Adaptive vsync is not supported here, using vsync\n");
+    pacer.mode = PACING_VSYNC;
+  }
+  glfwSwapInterval(pacer.mode == PACING_VSYNC ? 1 : pacer.mode == PACING_ADAPTIVE ? -1 : 0);
+  pacer.next_frame = glfwGetTime();
+}
+
+void reportPacing ()
+{
+  if (!pacer.frames)
+    return;
+  printf("Pacing %s", PACING_NAMES[pacer.mode]);
+  if (pacer.mode == PACING_LIMIT)
+    printf(" (%.1f fps)", pacer.target_fps);
+  printf(": %ld frames, mean %.3f ms, variance %.4f ms^2 (stddev %.3f ms), min %.3f ms, max %.3f ms\n",
+         pacer.frames, pacer.mean_ms, pacer.variance(), std::sqrt(pacer.variance()), pacer.min_ms, pacer.max_ms);
+}
+
+/* --bench-frames N: after BENCH_WARMUP_FRAMES frames, time N frames, then
+   write frame time percentiles and the memory figures as JSON to
+   --bench-json FILE (stdout by default) and exit */
+long bench_frames = 0;
+const char *bench_json_path = "-";
+const int BENCH_WARMUP_FRAMES = 30;
+std::vector<double> bench_frame_ms;
+uint64_t bench_heap_allocations, bench_gpu_allocations; // totals when timing began
+
+/* --check-frame-allocs: once past the warm-up, draw() must not touch the
+   heap. Offending frames are reported and fail the benchmark. */
+bool check_frame_allocs = false;
+uint64_t steady_draw_allocations = 0;
+long steady_allocating_frames = 0;
+
+uint64_t totalAllocations (const MemoryCounters *counters)
+{
+  uint64_t total = 0;
+  for (int tag = 0; tag < NUM_MEMORY_TAGS; tag++)
+    total += counters[tag].allocations.load(std::memory_order_relaxed);
+  return total;
+}
+
+void startBenchmark ()
+{
+  bench_frame_ms.reserve(bench_frames);
+  bench_heap_allocations = totalAllocations(heap_memory);
+  bench_gpu_allocations = totalAllocations(gpu_memory);
+}
+
+bool writeBenchReport ()
+{
+  FILE *out = strcmp(bench_json_path, "-") ? fopen(bench_json_path, "w") : stdout;
+  if (!out) {
+    fprintf(stderr, "Cannot write benchmark report to %s\n", bench_json_path);
+    return false;
+  }
+  std::vector<double> sorted(bench_frame_ms);
+  std::sort(sorted.begin(), sorted.end());
+  size_t n = sorted.size();
+  double mean = n ? std::accumulate(sorted.begin(), sorted.end(), 0.0) / n : 0;
+  double variance = 0;
+  for (size_t i = 0; i < n; i++)
+    variance += (sorted[i] - mean) * (sorted[i] - mean);
+  variance = n > 1 ? variance / (n - 1) : 0;
+  fprintf(out, "{\n  \"frames\": %zu,\n", n);
+  fprintf(out, "  \"pacing\": \"%s\",\n", PACING_NAMES[pacer.mode]);
+  if (pacer.mode == PACING_LIMIT)
+    fprintf(out, "  \"target_fps\": %.1f,\n", pacer.target_fps);
+  fprintf(out, "  \"frame_ms\": { \"mean\": %.3f, \"p50\": %.3f, \"p99\": %.3f, \"max\": %.3f, \"variance\": %.4f, \"stddev\": %.3f },\n",
+          mean, n ? sorted[n / 2] : 0, n ? sorted[std::min(n - 1, n * 99 / 100)] : 0, n ? sorted[n - 1] : 0,
+          variance, std::sqrt(variance));
+  fprintf(out, "  \"heap_allocations_per_frame\": %.2f,\n",
+          n ? (double) (totalAllocations(heap_memory) - bench_heap_allocations) / n : 0);
+  fprintf(out, "  \"gpu_allocations_per_frame\": %.2f,\n",
+          n ? (double) (totalAllocations(gpu_memory) - bench_gpu_allocations) / n : 0);
+  if (check_frame_allocs)
+    fprintf(out, "  \"draw_heap_allocations\": %llu,\n  \"draw_allocating_frames\": %ld,\n",
+            (unsigned long long) steady_draw_allocations, steady_allocating_frames);
+  fprintf(out, "  \"frame_arena_bytes\": %zu,\n", frame_arena.capacity());
+  fprintf(out, "  \"memory\": ");
+  writeMemoryJson(out, "  ");
+  fprintf(out, "\n}\n");
+  if (out != stdout)
+    fclose(out);
+  else
+    fflush(out);
+  return true;
+}
+
+/* Program binary cache: linked programs are saved with glGetProgramBinary
+   and reloaded with glProgramBinary on the next start. Entries are keyed
+   by a hash of the shader sources and the driver's vendor, renderer and
+   version strings, so a driver update or a shader edit simply misses.
+   Next to the binaries, <program>.key records the key each program (named
+   by its shader files) was last stored under, so the entry a shader edit
+   or driver update superseded is deleted instead of piling up. */
+bool shader_cache_enabled = true;
+const char *shader_cache_dir = "shader_cache";
+
+struct ProgramCacheHeader {
+  char magic[8];      // "GLPBIN1"
+  uint64_t key;       // cache key the binary was stored under
+  uint64_t checksum;  // FNV-1a of the binary payload
+  uint32_t format;    // binaryFormat from glGetProgramBinary
+  uint32_t length;    // payload bytes following the header
+};
+
+uint64_t fnv1a (const void *data, size_t size, uint64_t hash = 0xcbf29ce484222325ULL)
+{
+  const unsigned char *bytes = (const unsigned char *) data;
+  for (size_t i = 0; i < size; i++) {
+    hash ^= bytes[i];
+    hash *= 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+bool programBinarySupported ()
+{
+  if (!shader_cache_enabled || !glGetProgramBinary || !glProgramBinary || !glProgramParameteri)
+    return false;
+  GLint formats = 0;
+  glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+  return formats > 0;
+}
+
+uint64_t programCacheKey (const std::string &vertex_code, const std::string &fragment_code)
+{
+  uint64_t key = fnv1a(vertex_code.data(), vertex_code.size());
+  key = fnv1a(fragment_code.data(), fragment_code.size(), key);
+  const GLenum driver_strings[3] = { GL_VENDOR, GL_RENDERER, GL_VERSION };
+  for (int i = 0; i < 3; i++) {
+    const char *str = (const char *) glGetString(driver_strings[i]);
+    if (str)
+      key = fnv1a(str, strlen(str) + 1, key);
+  }
+  return key;
+}
+
+/* Identifies a program across source edits, for replacing its old entry */
+uint64_t programCacheId (const std::string &vertex_name, const std::string &fragment_name)
+{
+  uint64_t id = fnv1a(vertex_name.c_str(), vertex_name.size() + 1);
+  return fnv1a(fragment_name.c_str(), fragment_name.size() + 1, id);
+}
+
+std::string programCachePath (uint64_t key, const char *extension = ".bin")
+{
+  char name[32];
+  snprintf(name, sizeof(name), "/%016llx%s", (unsigned long long) key, extension);
+  return shader_cache_dir + std::string(name);
+}
+
+/* Record key as the current entry of program id, removing the one it replaces */
+void replaceCachedProgram (uint64_t id, uint64_t key)
+{
+  std::string key_path = programCachePath(id, ".key");
+  unsigned long long old_key = 0;
+  FILE *in = fopen(key_path.c_str(), "r");
+  if (in) {
+    if (fscanf(in, "%llx", &old_key) == 1 && old_key != key)
+      remove(programCachePath(old_key).c_str());
+    fclose(in);
+  }
+  if (in && old_key == key)
+    return;
+  std::string tmp_path = key_path + ".tmp";
+  FILE *out = fopen(tmp_path.c_str(), "w");
+  if (!out)
+    return;
+  bool written = fprintf(out, "%016llx\n", (unsigned long long) key) > 0;
+  if (fclose(out) != 0 || !written || rename(tmp_path.c_str(), key_path.c_str()) != 0)
+    remove(tmp_path.c_str());
+}
+
+/* Returns a linked program from the cache, or 0 if there is no valid entry.
+   Stale or corrupt entries are removed. */
+GLuint loadCachedProgram (uint64_t key)
+{
+  std::string path = programCachePath(key);
+  std::ifstream in(path.c_str(), std::ios::in | std::ios::binary);
+  if (!in.is_open())
+    return 0;
+
+  ProgramCacheHeader header;
+  std::vector<char> binary;
+  bool valid = false;
+  if (in.read((char *) &header, sizeof(header)) && !memcmp(header.magic, "GLPBIN1", 8) && header.key == key) {
+    binary.resize(header.length);
+    valid = header.length > 0 && in.read(&binary[0], header.length) && in.peek() == EOF
+      && fnv1a(&binary[0], binary.size()) == header.checksum;
+  }
+  in.close();
+
+  GLuint ProgramID = 0;
+  if (valid) {
+    ProgramID = glCreateProgram();
+    glProgramBinary(ProgramID, header.format, &binary[0], (GLsizei) binary.size());
+    GLint Result = GL_FALSE;
+    glGetProgramiv(ProgramID, GL_LINK_STATUS, &Result);
+    if (Result != GL_TRUE) {
+      // The driver rejected the binary, e.g. after an update it does not report in its version
+      glDeleteProgram(ProgramID);
+      ProgramID = 0;
+    }
+  }
+  if (!ProgramID) {
+    fprintf(stdout, "Discarding stale program cache %s\n", path.c_str());
+    remove(path.c_str());
+  }
+  return ProgramID;
+}
+
+void storeCachedProgram (uint64_t id, uint64_t key, GLuint ProgramID)
+{
+  GLint length = 0;
+  glGetProgramiv(ProgramID, GL_PROGRAM_BINARY_LENGTH, &length);
+  if (length <= 0)
+    return;
+
+  std::vector<char> binary(length);
+  ProgramCacheHeader header;
+  memcpy(header.magic, "GLPBIN1", 8);
+  header.key = key;
+  GLenum format = 0;
+  glGetProgramBinary(ProgramID, length, &length, &format, &binary[0]);
+  header.format = format;
+  header.length = (uint32_t) length;
+  header.checksum = fnv1a(&binary[0], length);
+
+  mkdir(shader_cache_dir, 0755);
+  std::string path = programCachePath(key);
+  std::string tmp_path = path + ".tmp";
+  std::ofstream out(tmp_path.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+  if (!out.is_open())
+    return;
+  out.write((const char *) &header, sizeof(header));
+  out.write(&binary[0], length);
+  out.close();
+  // Rename into place so a concurrent start never reads a half written entry
+  if (!out || rename(tmp_path.c_str(), path.c_str()) != 0) {
+    remove(tmp_path.c_str());
+    return;
+  }
+  replaceCachedProgram(id, key);
+}
+
+/* Shader sources are embedded at build time by the Makefile (see the
+   shaders.gen.h rule), so a normal start does no shader file I/O and does
+   not depend on the working directory. For shader development, point
+   --shader-dir (or the SHADER_DIR environment variable) at a directory and
+   the files there are read instead. */
+#if defined(__has_include)
+#if __has_include("shaders.gen.h")
+#include "shaders.gen.h"
+#define HAVE_EMBEDDED_SHADERS
+#endif
+#endif
+
+const char *shader_dir = NULL;
+
+/* Read a whole file in one go */
+bool readShaderFile (const std::string &path, std::string &code)
+{
+	std::ifstream ShaderStream(path.c_str(), std::ios::in | std::ios::binary);
+	if(!ShaderStream.is_open())
+		return false;
+	ShaderStream.seekg(0, std::ios::end);
+	std::streamoff size = ShaderStream.tellg();
+	if (size < 0)
+		return false;
+	code.resize((size_t) size);
+	ShaderStream.seekg(0, std::ios::beg);
+	if (size > 0)
+		ShaderStream.read(&code[0], size);
+	return !ShaderStream.fail();
+}
+
+/* Fetch the source of a shader: the development directory if one is set,
+   otherwise the copy embedded in the binary, otherwise the file itself */
+std::string shaderSource (const char *file_path)
+{
+	std::string code;
+	const char *name = strrchr(file_path, '/') ? strrchr(file_path, '/') + 1 : file_path;
+	if (shader_dir) {
+		if (readShaderFile(std::string(shader_dir) + "/" + name, code))
+			return code;
+		fprintf(stderr, "Error: cannot read shader %s from %s\n", name, shader_dir);
+		exit(EXIT_FAILURE);
+	}
+#ifdef HAVE_EMBEDDED_SHADERS
+	for (const EmbeddedShader *shader = embedded_shaders; shader->name; shader++)
+		if (!strcmp(shader->name, name))
+			return shader->source;
+#endif
+	if (!readShaderFile(file_path, code)) {
+		fprintf(stderr, "Error: shader %s is neither embedded nor readable\n", file_path);
+		exit(EXIT_FAILURE);
+	}
+	return code;
+}
+
+/* Programs are built in two halves so that several can compile at once:
+   submitProgram() hands the sources to the driver and links without
+   asking for any status, finishProgram() later collects the result. With
+   GL_KHR/ARB_parallel_shader_compile the driver compiles on its own
+   threads and programReady() can poll for completion without blocking;
+   without it the driver may still defer the work until the first query. */
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+
+bool parallel_shader_compile = false;
+
+bool hasGLExtension (const char *name)
+{
+  GLint count = 0;
+  glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+  for (GLint i = 0; i < count; i++) {
+    const char *ext = (const char *) glGetStringi(GL_EXTENSIONS, i);
+    if (ext && !strcmp(ext, name))
+      return true;
+  }
+  return false;
+}
+
+/* Let the driver use as many compiler threads as it likes, if it can */
+void enableParallelShaderCompile ()
+{
+  typedef void (*MaxShaderCompilerThreadsProc) (GLuint);
+  MaxShaderCompilerThreadsProc maxThreads = NULL;
+  if (hasGLExtension("GL_KHR_parallel_shader_compile"))
+    maxThreads = (MaxShaderCompilerThreadsProc) glfwGetProcAddress("glMaxShaderCompilerThreadsKHR");
+  else if (hasGLExtension("GL_ARB_parallel_shader_compile"))
+    maxThreads = (MaxShaderCompilerThreadsProc) glfwGetProcAddress("glMaxShaderCompilerThreadsARB");
+  if (maxThreads) {
+    maxThreads(0xFFFFFFFFu);
+    parallel_shader_compile = true;
+  }
+}
+
+struct ProgramBuild {
+  std::string vertex_name, fragment_name; // for messages only
+  GLuint vertex_shader, fragment_shader;
+  GLuint program;
+  bool use_cache, from_cache;
+  uint64_t cache_key;
+};
+
+void printShaderLog (GLuint shader, const std::string &name)
+{
+  GLint Result = GL_FALSE, InfoLogLength = 0;
+  glGetShaderiv(shader, GL_COMPILE_STATUS, &Result);
+  if (Result == GL_TRUE)
+    return;
+  glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &InfoLogLength);
+  std::vector<char> ShaderErrorMessage(max(InfoLogLength, int(1)));
+  glGetShaderInfoLog(shader, InfoLogLength, NULL, &ShaderErrorMessage[0]);
+  fprintf(stdout, "%s: %s\n", name.c_str(), &ShaderErrorMessage[0]);
+}
+
+/* Start building a program; returns immediately */
+void submitProgram (ProgramBuild &build, const std::string &VertexShaderCode, const std::string &FragmentShaderCode,
+                    const char * vertex_file_path, const char * fragment_file_path)
+{
+  build.vertex_name = vertex_file_path;
+  build.fragment_name = fragment_file_path;
+  build.vertex_shader = build.fragment_shader = 0;
+  build.from_cache = false;
+
+  // Use the cached binary when this driver has already linked these sources
+  build.use_cache = programBinarySupported();
+  build.cache_key = 0;
+  if (build.use_cache) {
+    build.cache_key = programCacheKey(VertexShaderCode, FragmentShaderCode);
+    build.program = loadCachedProgram(build.cache_key);
+    if (build.program) {
+      printf("Loaded cached program for %s, %s\n", vertex_file_path, fragment_file_path);
+      build.from_cache = true;
+      return;
+    }
+  }
+
+  printf("Compiling shaders : %s, %s\n", vertex_file_path, fragment_file_path);
+  build.vertex_shader = glCreateShader(GL_VERTEX_SHADER);
+  char const * VertexSourcePointer = VertexShaderCode.c_str();
+  glShaderSource(build.vertex_shader, 1, &VertexSourcePointer , NULL);
+  glCompileShader(build.vertex_shader);
+
+  build.fragment_shader = glCreateShader(GL_FRAGMENT_SHADER);
+  char const * FragmentSourcePointer = FragmentShaderCode.c_str();
+  glShaderSource(build.fragment_shader, 1, &FragmentSourcePointer , NULL);
+  glCompileShader(build.fragment_shader);
+
+  // Link without waiting for the compiles; a failed compile fails the link
+  build.program = glCreateProgram();
+  glAttachShader(build.program, build.vertex_shader);
+  glAttachShader(build.program, build.fragment_shader);
+  if (build.use_cache)
+    glProgramParameteri(build.program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+  glLinkProgram(build.program);
+}
+
+/* True once finishProgram() would not block */
+bool programReady (const ProgramBuild &build)
+{
+  if (build.from_cache || !parallel_shader_compile)
+    return true;
+  GLint done = GL_FALSE;
+  glGetProgramiv(build.program, GL_COMPLETION_STATUS_KHR, &done);
+  return done == GL_TRUE;
+}
+
+/* Wait for a submitted program and return it. Logs are only fetched when
+   the link failed; check GL_LINK_STATUS to see whether it worked. */
+GLuint finishProgram (ProgramBuild &build)
+{
+  if (build.from_cache)
+    return build.program;
+
+  GLint Result = GL_FALSE;
+  glGetProgramiv(build.program, GL_LINK_STATUS, &Result);
+  if (Result != GL_TRUE) {
+    printShaderLog(build.vertex_shader, build.vertex_name);
+    printShaderLog(build.fragment_shader, build.fragment_name);
+    GLint InfoLogLength = 0;
+    glGetProgramiv(build.program, GL_INFO_LOG_LENGTH, &InfoLogLength);
+    std::vector<char> ProgramErrorMessage( max(InfoLogLength, int(1)) );
+    glGetProgramInfoLog(build.program, InfoLogLength, NULL, &ProgramErrorMessage[0]);
+    fprintf(stdout, "Linking %s, %s failed: %s\n", build.vertex_name.c_str(), build.fragment_name.c_str(), &ProgramErrorMessage[0]);
+  }
+
+  glDetachShader(build.program, build.vertex_shader);
+  glDetachShader(build.program, build.fragment_shader);
+  glDeleteShader(build.vertex_shader);
+  glDeleteShader(build.fragment_shader);
+
+  if (build.use_cache && Result == GL_TRUE)
+    storeCachedProgram(programCacheId(build.vertex_name, build.fragment_name), build.cache_key, build.program);
+
+  return build.program;
+}
+
+/* Compile and link a program from its sources, blocking until done */
+GLuint CompileProgram(const std::string &VertexShaderCode, const std::string &FragmentShaderCode,
+                      const char * vertex_file_path, const char * fragment_file_path) {
+	ProgramBuild build;
+	submitProgram(build, VertexShaderCode, FragmentShaderCode, vertex_file_path, fragment_file_path);
+	return finishProgram(build);
+}
 
 /* Function to load Shaders - Use it as it is */
 GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path) {
+	return CompileProgram(shaderSource(vertex_file_path), shaderSource(fragment_file_path),
+	                      vertex_file_path, fragment_file_path);
+}
 
-	// Create the shaders
-	GLuint VertexShaderID = glCreateShader(GL_VERTEX_SHADER);
-	GLuint FragmentShaderID = glCreateShader(GL_FRAGMENT_SHADER);
-
-	// Read the Vertex Shader code from the file
-	std::string VertexShaderCode;
-	std::ifstream VertexShaderStream(vertex_file_path, std::ios::in);
-	if(VertexShaderStream.is_open())
-	{
-		std::string Line = "";
-		while(getline(VertexShaderStream, Line))
-			VertexShaderCode += "\n" + Line;
-		VertexShaderStream.close();
-	}
+/* Start loading a program from shader files without waiting for it */
+void submitShaders (ProgramBuild &build, const char * vertex_file_path, const char * fragment_file_path)
+{
+	submitProgram(build, shaderSource(vertex_file_path), shaderSource(fragment_file_path),
+	              vertex_file_path, fragment_file_path);
+}
 
-	// Read the Fragment Shader code from the file
-	std::string FragmentShaderCode;
-	std::ifstream FragmentShaderStream(fragment_file_path, std::ios::in);
-	if(FragmentShaderStream.is_open()){
-		std::string Line = "";
-		while(getline(FragmentShaderStream, Line))
-			FragmentShaderCode += "\n" + Line;
-		FragmentShaderStream.close();
-	}
+/* Shader hot reload: while shaders are read from --shader-dir, a watcher
+   thread follows edits there with inotify, reads and sanity checks the new
+   sources off the render thread, and hands them over. The render thread
+   compiles them at the next frame boundary and swaps the program only if
+   it links; otherwise the old program stays in place. */
+struct ReloadableProgram {
+  std::string vertex_name, fragment_name;
+  GpuHandle *program;
+  void (*on_swap) (GLuint program); // refresh uniform locations and the like
+  bool pending;
+  std::string vertex_code, fragment_code;
+  bool building; // a submitted rebuild the render thread is waiting on
+  ProgramBuild build;
+};
+
+std::mutex shader_reload_mutex;
+std::vector<ReloadableProgram> reloadable_programs;
+std::thread shader_watch_thread;
+std::atomic<bool> shader_watch_running(false);
+
+/* Register a program for hot reload; call before startShaderWatcher() */
+void watchProgram (GpuHandle *program, const char *vertex_name, const char *fragment_name, void (*on_swap) (GLuint))
+{
+  MemoryScope memory_scope(MEM_SHADERS);
+  ReloadableProgram entry;
+  entry.vertex_name = vertex_name;
+  entry.fragment_name = fragment_name;
+  entry.program = program;
+  entry.on_swap = on_swap;
+  entry.pending = false;
+  entry.building = false;
+  reloadable_programs.push_back(entry);
+}
+
+/* Cheap checks that catch half written files before they reach the driver */
+bool plausibleShaderSource (const std::string &code)
+{
+  if (code.find("#version") == std::string::npos || code.find("main") == std::string::npos)
+    return false;
+  int depth = 0;
+  for (size_t i = 0; i < code.size() && depth >= 0; i++) {
+    if (code[i] == '{')
+      depth++;
+    else if (code[i] == '}')
+      depth--;
+  }
+  return depth == 0;
+}
+
+#ifdef __linux__
+void shaderWatchLoop (int fd)
+{
+  MemoryScope memory_scope(MEM_SHADERS);
+  alignas(struct inotify_event) char buffer[4096];
+  while (shader_watch_running.load(std::memory_order_acquire)) {
+    struct pollfd pfd = { fd, POLLIN, 0 };
+    if (poll(&pfd, 1, 200) <= 0)
+      continue;
+    ssize_t len = read(fd, buffer, sizeof(buffer));
+    if (len <= 0)
+      continue;
+
+    // Editors often produce several events per save; reload each program once
+    std::vector<bool> touched(reloadable_programs.size(), false);
+    for (char *p = buffer; p < buffer + len; ) {
+      struct inotify_event *event = (struct inotify_event *) p;
+      if (event->len)
+        for (size_t i = 0; i < reloadable_programs.size(); i++)
+          if (reloadable_programs[i].vertex_name == event->name || reloadable_programs[i].fragment_name == event->name)
+            touched[i] = true;
+      p += sizeof(struct inotify_event) + event->len;
+    }
+
+    for (size_t i = 0; i < touched.size(); i++) {
+      if (!touched[i])
+        continue;
+      std::string vertex_code, fragment_code;
+      const ReloadableProgram &entry = reloadable_programs[i];
+      if (!readShaderFile(std::string(shader_dir) + "/" + entry.vertex_name, vertex_code)
+          || !readShaderFile(std::string(shader_dir) + "/" + entry.fragment_name, fragment_code)
+          || !plausibleShaderSource(vertex_code) || !plausibleShaderSource(fragment_code)) {
+        printf("Shader edit to %s/%s not usable yet, ignored\n", entry.vertex_name.c_str(), entry.fragment_name.c_str());
+        continue;
+      }
+      std::lock_guard<std::mutex> lock(shader_reload_mutex);
+      reloadable_programs[i].vertex_code.swap(vertex_code);
+      reloadable_programs[i].fragment_code.swap(fragment_code);
+      reloadable_programs[i].pending = true;
+    }
+  }
+  close(fd);
+}
+#endif
 
-	GLint Result = GL_FALSE;
-	int InfoLogLength;
-
-	// Compile Vertex Shader
-	printf("Compiling shader : %s\n", vertex_file_path);
-	char const * VertexSourcePointer = VertexShaderCode.c_str();
-	glShaderSource(VertexShaderID, 1, &VertexSourcePointer , NULL);
-	glCompileShader(VertexShaderID);
-
-	// Check Vertex Shader
-	glGetShaderiv(VertexShaderID, GL_COMPILE_STATUS, &Result);
-	glGetShaderiv(VertexShaderID, GL_INFO_LOG_LENGTH, &InfoLogLength);
-	std::vector<char> VertexShaderErrorMessage(InfoLogLength);
-	glGetShaderInfoLog(VertexShaderID, InfoLogLength, NULL, &VertexShaderErrorMessage[0]);
-	fprintf(stdout, "%s\n", &VertexShaderErrorMessage[0]);
-
-	// Compile Fragment Shader
-	printf("Compiling shader : %s\n", fragment_file_path);
-	char const * FragmentSourcePointer = FragmentShaderCode.c_str();
-	glShaderSource(FragmentShaderID, 1, &FragmentSourcePointer , NULL);
-	glCompileShader(FragmentShaderID);
-
-	// Check Fragment Shader
-	glGetShaderiv(FragmentShaderID, GL_COMPILE_STATUS, &Result);
-	glGetShaderiv(FragmentShaderID, GL_INFO_LOG_LENGTH, &InfoLogLength);
-	std::vector<char> FragmentShaderErrorMessage(InfoLogLength);
-	glGetShaderInfoLog(FragmentShaderID, InfoLogLength, NULL, &FragmentShaderErrorMessage[0]);
-	fprintf(stdout, "%s\n", &FragmentShaderErrorMessage[0]);
-
-	// Link the program
-	fprintf(stdout, "Linking program\n");
-	GLuint ProgramID = glCreateProgram();
-	glAttachShader(ProgramID, VertexShaderID);
-	glAttachShader(ProgramID, FragmentShaderID);
-	glLinkProgram(ProgramID);
-
-	// Check the program
-	glGetProgramiv(ProgramID, GL_LINK_STATUS, &Result);
-	glGetProgramiv(ProgramID, GL_INFO_LOG_LENGTH, &InfoLogLength);
-	std::vector<char> ProgramErrorMessage( max(InfoLogLength, int(1)) );
-	glGetProgramInfoLog(ProgramID, InfoLogLength, NULL, &ProgramErrorMessage[0]);
-	fprintf(stdout, "%s\n", &ProgramErrorMessage[0]);
-
-	glDeleteShader(VertexShaderID);
-	glDeleteShader(FragmentShaderID);
-
-	return ProgramID;
+void startShaderWatcher ()
+{
+#ifdef __linux__
+  int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (fd < 0 || inotify_add_watch(fd, shader_dir, IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+    fprintf(stderr, "Shader hot reload unavailable: cannot watch %s\n", shader_dir);
+    if (fd >= 0)
+      close(fd);
+    return;
+  }
+  printf("Watching %s for shader edits\n", shader_dir);
+  shader_watch_running.store(true, std::memory_order_release);
+  shader_watch_thread = std::thread(shaderWatchLoop, fd);
+#else
+  printf("Shader hot reload is only available on Linux\n");
+#endif
+}
+
+void stopShaderWatcher ()
+{
+  shader_watch_running.store(false, std::memory_order_release);
+  if (shader_watch_thread.joinable())
+    shader_watch_thread.join();
+}
+
+/* Called by the render thread between frames. Edited sources are only
+   submitted here; the swap happens on a later frame once the driver
+   reports the program done, so a reload never stalls a frame. */
+void applyShaderReloads ()
+{
+  MemoryScope memory_scope(MEM_SHADERS);
+  for (size_t i = 0; i < reloadable_programs.size(); i++) {
+    ReloadableProgram &entry = reloadable_programs[i];
+    if (entry.building && programReady(entry.build)) {
+      entry.building = false;
+      GLuint program = finishProgram(entry.build);
+      GLint linked = GL_FALSE;
+      glGetProgramiv(program, GL_LINK_STATUS, &linked);
+      if (linked != GL_TRUE) {
+        printf("Reload of %s/%s failed, keeping the previous program\n", entry.vertex_name.c_str(), entry.fragment_name.c_str());
+        glDeleteProgram(program);
+      }
+      else {
+        gpuRelease(*entry.program);
+        *entry.program = gpuAdopt(GPU_PROGRAM, program);
+        if (entry.on_swap)
+          entry.on_swap(program);
+        printf("Reloaded %s/%s\n", entry.vertex_name.c_str(), entry.fragment_name.c_str());
+      }
+    }
+    if (entry.building)
+      continue;
+
+    std::string vertex_code, fragment_code;
+    {
+      std::lock_guard<std::mutex> lock(shader_reload_mutex);
+      if (!entry.pending)
+        continue;
+      entry.pending = false;
+      vertex_code.swap(entry.vertex_code);
+      fragment_code.swap(entry.fragment_code);
+    }
+    submitProgram(entry.build, vertex_code, fragment_code, entry.vertex_name.c_str(), entry.fragment_name.c_str());
+    entry.building = true;
+  }
 }
 
 static void error_callback(int error, const char* description)
@@ -114,102 +1513,420 @@ static void error_callback(int error, const char* description)
   fprintf(stderr, "Error: %s\n", description);
 }
 
-void quit(GLFWwindow *window)
+void stopSimulation ();
+
+void reportInputLatency ();
+
+void stopShaderWatcher ();
+
+void quit(GLFWwindow *window)
+{
+  stopShaderWatcher();
+  stopSimulation();
+  reportInputLatency();
+  reportPacing();
+  releaseGpuResources();
+  glfwDestroyWindow(window);
+  glfwTerminate();
+  exit(EXIT_SUCCESS);
+}
+
+
+/* Copy a mesh into the shared geometry buffers straight from caller memory
+   (e.g. a mapped level pack) and return its handle */
+MeshHandle create3DObjectIndexed (GLenum primitive_mode, int numVertices, const MeshVertex* vertex_data,
+                                  int numIndices, const GLuint* index_data, GLenum fill_mode=GL_FILL)
+{
+  VAO vao = VAO();
+  vao.PrimitiveMode = primitive_mode;
+  vao.NumVertices = numVertices;
+  vao.NumIndices = numIndices;
+  vao.FillMode = fill_mode;
+  allocateGeometry(vao, vertex_data, index_data);
+  return meshes.insert(vao);
+}
+
+/* Add a mesh to the shared geometry buffers and return its handle */
+MeshHandle create3DObject (GLenum primitive_mode, int numVertices, const GLfloat* vertex_buffer_data, const GLfloat* color_buffer_data, GLenum fill_mode=GL_FILL)
+{
+  // Interleave positions and colors; the mesh is drawn as indices 0..n-1
+  std::vector<MeshVertex> vertices (numVertices);
+  std::vector<GLuint> indices (numVertices);
+  for (int i=0; i<numVertices; i++) {
+    memcpy(vertices[i].position, vertex_buffer_data + 3*i, sizeof(vertices[i].position));
+    memcpy(vertices[i].color, color_buffer_data + 3*i, sizeof(vertices[i].color));
+    indices[i] = i;
+  }
+  return create3DObjectIndexed(primitive_mode, numVertices, vertices.data(), numVertices, indices.data(), fill_mode);
+}
+
+/* Add a mesh to the shared geometry buffers - Common Color for all vertices */
+  MeshHandle create3DObject (GLenum primitive_mode, int numVertices, const GLfloat* vertex_buffer_data, const GLfloat red, const GLfloat green, const GLfloat blue, GLenum fill_mode=GL_FILL)
+  {
+    std::vector<GLfloat> color_buffer_data (3*numVertices);
+    for (int i=0; i<numVertices; i++) {
+      color_buffer_data [3*i] = red;
+      color_buffer_data [3*i + 1] = green;
+      color_buffer_data [3*i + 2] = blue;
+    }
+
+    return create3DObject(primitive_mode, numVertices, vertex_buffer_data, color_buffer_data.data(), fill_mode);
+  }
+
+/* Render the VBOs handled by VAO; a released mesh draws nothing */
+  void draw3DObject (MeshHandle mesh, int instances=1)
+  {
+    VAO *vao = meshes.get(mesh);
+    if (!vao)
+      return;
+
+    // Change the Fill Mode for this object
+    glPolygonMode (GL_FRONT_AND_BACK, vao->FillMode);
+
+    // Every mesh lives in the shared buffers behind one VAO
+    bindVertexArray (gpuName(geometry.vertex_array));
+
+    // Draw the geometry !
+    const void *first_index = (const void*)(vao->FirstIndex * sizeof(GLuint));
+    if (instances != 1)
+      glDrawElementsInstancedBaseVertex(vao->PrimitiveMode, vao->NumIndices, GL_UNSIGNED_INT, first_index, instances, vao->BaseVertex);
+    else
+      glDrawElementsBaseVertex(vao->PrimitiveMode, vao->NumIndices, GL_UNSIGNED_INT, first_index, vao->BaseVertex);
+  }
+
+/**************************
+ * Batch transforms       *
+ **************************/
+
+/* Model matrices T * R * S for arrays of instances, one array per
+   component (SoA) so the SIMD kernels load 4 (SSE) or 8 (AVX2) instances
+   per instruction and only transpose when storing the column-major
+   matrices. The kernel is picked once from the CPU's features. */
+struct TransformBatch {
+  std::vector<float> tx, ty, tz;     // translation
+  std::vector<float> qx, qy, qz, qw; // rotation, unit quaternion
+  std::vector<float> sx, sy, sz;     // scale
+
+  size_t size () const { return tx.size(); }
+
+  void resize (size_t n)
+  {
+    std::vector<float> *fields[] = { &tx, &ty, &tz, &qx, &qy, &qz, &qw, &sx, &sy, &sz };
+    for (size_t f = 0; f < sizeof(fields) / sizeof(fields[0]); f++)
+      fields[f]->resize(n);
+  }
+
+  void set (size_t i, const glm::vec3 &t, const glm::quat &q, const glm::vec3 &s)
+  {
+    tx[i] = t.x; ty[i] = t.y; tz[i] = t.z;
+    qx[i] = q.x; qy[i] = q.y; qz[i] = q.z; qw[i] = q.w;
+    sx[i] = s.x; sy[i] = s.y; sz[i] = s.z;
+  }
+};
+
+typedef void (*TransformKernel) (const TransformBatch &batch, size_t first, size_t count, glm::mat4 *out);
+
+/* Same expansion as glm::translate(t) * glm::mat4_cast(q) * glm::scale(s) */
+void transformScalar (const TransformBatch &b, size_t first, size_t count, glm::mat4 *out)
+{
+  for (size_t i = first; i < first + count; i++, out++) {
+    float x = b.qx[i], y = b.qy[i], z = b.qz[i], w = b.qw[i];
+    float xx = x * x, yy = y * y, zz = z * z;
+    float xy = x * y, xz = x * z, yz = y * z, wx = w * x, wy = w * y, wz = w * z;
+    float *m = &(*out)[0][0];
+    m[0] = (1 - 2 * (yy + zz)) * b.sx[i]; m[1] = 2 * (xy + wz) * b.sx[i]; m[2] = 2 * (xz - wy) * b.sx[i]; m[3] = 0;
+    m[4] = 2 * (xy - wz) * b.sy[i]; m[5] = (1 - 2 * (xx + zz)) * b.sy[i]; m[6] = 2 * (yz + wx) * b.sy[i]; m[7] = 0;
+    m[8] = 2 * (xz + wy) * b.sz[i]; m[9] = 2 * (yz - wx) * b.sz[i]; m[10] = (1 - 2 * (xx + yy)) * b.sz[i]; m[11] = 0;
+    m[12] = b.tx[i]; m[13] = b.ty[i]; m[14] = b.tz[i]; m[15] = 1;
+  }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+#define HAVE_X86_TRANSFORMS 1
+
+/* Four instances' values of one column, lane j belonging to instance j,
+   stored as column `col` of out[0..3] */
+inline void storeColumnsSSE (glm::mat4 *out, int col, __m128 a, __m128 b, __m128 c, __m128 d)
+{
+  _MM_TRANSPOSE4_PS(a, b, c, d);
+  _mm_storeu_ps(&out[0][col][0], a);
+  _mm_storeu_ps(&out[1][col][0], b);
+  _mm_storeu_ps(&out[2][col][0], c);
+  _mm_storeu_ps(&out[3][col][0], d);
+}
+
+void transformSSE (const TransformBatch &b, size_t first, size_t count, glm::mat4 *out)
+{
+  const __m128 one = _mm_set1_ps(1), two = _mm_set1_ps(2), zero = _mm_setzero_ps();
+  size_t i = first, end = first + count;
+  for (; i + 4 <= end; i += 4, out += 4) {
+    __m128 x = _mm_loadu_ps(&b.qx[i]), y = _mm_loadu_ps(&b.qy[i]);
+    __m128 z = _mm_loadu_ps(&b.qz[i]), w = _mm_loadu_ps(&b.qw[i]);
+    __m128 sx = _mm_loadu_ps(&b.sx[i]), sy = _mm_loadu_ps(&b.sy[i]), sz = _mm_loadu_ps(&b.sz[i]);
+    __m128 xx = _mm_mul_ps(x, x), yy = _mm_mul_ps(y, y), zz = _mm_mul_ps(z, z);
+    __m128 xy = _mm_mul_ps(x, y), xz = _mm_mul_ps(x, z), yz = _mm_mul_ps(y, z);
+    __m128 wx = _mm_mul_ps(w, x), wy = _mm_mul_ps(w, y), wz = _mm_mul_ps(w, z);
+
+    storeColumnsSSE(out, 0,
+                    _mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(yy, zz))), sx),
+                    _mm_mul_ps(_mm_mul_ps(two, _mm_add_ps(xy, wz)), sx),
+                    _mm_mul_ps(_mm_mul_ps(two, _mm_sub_ps(xz, wy)), sx), zero);
+    storeColumnsSSE(out, 1,
+                    _mm_mul_ps(_mm_mul_ps(two, _mm_sub_ps(xy, wz)), sy),
+                    _mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, zz))), sy),
+                    _mm_mul_ps(_mm_mul_ps(two, _mm_add_ps(yz, wx)), sy), zero);
+    storeColumnsSSE(out, 2,
+                    _mm_mul_ps(_mm_mul_ps(two, _mm_add_ps(xz, wy)), sz),
+                    _mm_mul_ps(_mm_mul_ps(two, _mm_sub_ps(yz, wx)), sz),
+                    _mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, yy))), sz), zero);
+    storeColumnsSSE(out, 3, _mm_loadu_ps(&b.tx[i]), _mm_loadu_ps(&b.ty[i]), _mm_loadu_ps(&b.tz[i]), one);
+  }
+  transformScalar(b, i, end - i, out);
+}
+
+/* In-lane transpose of one column of eight instances: leaves instance j's
+   column in the low half of r[j] and instance j+4's in the high half */
+__attribute__((target("avx2,fma")))
+inline void transposeColumnAVX2 (__m256 a, __m256 b, __m256 c, __m256 d, __m256 r[4])
+{
+  __m256 t0 = _mm256_unpacklo_ps(a, b), t1 = _mm256_unpackhi_ps(a, b);
+  __m256 t2 = _mm256_unpacklo_ps(c, d), t3 = _mm256_unpackhi_ps(c, d);
+  r[0] = _mm256_shuffle_ps(t0, t2, 0x44);
+  r[1] = _mm256_shuffle_ps(t0, t2, 0xEE);
+  r[2] = _mm256_shuffle_ps(t1, t3, 0x44);
+  r[3] = _mm256_shuffle_ps(t1, t3, 0xEE);
+}
+
+/* Pair up the transposed columns so each instance is written with two
+   32 byte stores */
+__attribute__((target("avx2,fma")))
+inline void storeMatricesAVX2 (glm::mat4 *out, __m256 c0[4], __m256 c1[4], __m256 c2[4], __m256 c3[4])
+{
+  for (int j = 0; j < 4; j++) {
+    _mm256_storeu_ps(&out[j][0][0], _mm256_permute2f128_ps(c0[j], c1[j], 0x20));
+    _mm256_storeu_ps(&out[j][2][0], _mm256_permute2f128_ps(c2[j], c3[j], 0x20));
+    _mm256_storeu_ps(&out[j + 4][0][0], _mm256_permute2f128_ps(c0[j], c1[j], 0x31));
+    _mm256_storeu_ps(&out[j + 4][2][0], _mm256_permute2f128_ps(c2[j], c3[j], 0x31));
+  }
+}
+
+__attribute__((target("avx2,fma")))
+void transformAVX2 (const TransformBatch &b, size_t first, size_t count, glm::mat4 *out)
+{
+  const __m256 one = _mm256_set1_ps(1), zero = _mm256_setzero_ps();
+  size_t i = first, end = first + count;
+  for (; i + 8 <= end; i += 8, out += 8) {
+    __m256 x = _mm256_loadu_ps(&b.qx[i]), y = _mm256_loadu_ps(&b.qy[i]);
+    __m256 z = _mm256_loadu_ps(&b.qz[i]), w = _mm256_loadu_ps(&b.qw[i]);
+    __m256 sx = _mm256_loadu_ps(&b.sx[i]), sy = _mm256_loadu_ps(&b.sy[i]), sz = _mm256_loadu_ps(&b.sz[i]);
+    __m256 x2 = _mm256_add_ps(x, x), y2 = _mm256_add_ps(y, y), z2 = _mm256_add_ps(z, z);
+    __m256 xx = _mm256_mul_ps(x, x2), yy = _mm256_mul_ps(y, y2), zz = _mm256_mul_ps(z, z2);
+    __m256 xy = _mm256_mul_ps(x, y2), xz = _mm256_mul_ps(x, z2), yz = _mm256_mul_ps(y, z2);
+    __m256 wx = _mm256_mul_ps(w, x2), wy = _mm256_mul_ps(w, y2), wz = _mm256_mul_ps(w, z2);
+
+    __m256 c0[4], c1[4], c2[4], c3[4];
+    transposeColumnAVX2(_mm256_mul_ps(_mm256_sub_ps(one, _mm256_add_ps(yy, zz)), sx),
+                        _mm256_mul_ps(_mm256_add_ps(xy, wz), sx),
+                        _mm256_mul_ps(_mm256_sub_ps(xz, wy), sx), zero, c0);
+    transposeColumnAVX2(_mm256_mul_ps(_mm256_sub_ps(xy, wz), sy),
+                        _mm256_mul_ps(_mm256_sub_ps(one, _mm256_add_ps(xx, zz)), sy),
+                        _mm256_mul_ps(_mm256_add_ps(yz, wx), sy), zero, c1);
+    transposeColumnAVX2(_mm256_mul_ps(_mm256_add_ps(xz, wy), sz),
+                        _mm256_mul_ps(_mm256_sub_ps(yz, wx), sz),
+                        _mm256_mul_ps(_mm256_sub_ps(one, _mm256_add_ps(xx, yy)), sz), zero, c2);
+    transposeColumnAVX2(_mm256_loadu_ps(&b.tx[i]), _mm256_loadu_ps(&b.ty[i]), _mm256_loadu_ps(&b.tz[i]), one, c3);
+    storeMatricesAVX2(out, c0, c1, c2, c3);
+  }
+  transformSSE(b, i, end - i, out);
+}
+#endif
+
+struct TransformKernelInfo {
+  const char *name;
+  TransformKernel kernel;
+  bool (*supported) ();
+};
+
+bool alwaysSupported () { return true; }
+#ifdef HAVE_X86_TRANSFORMS
+bool avx2Supported () { return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"); }
+#endif
+
+// Slowest first; the last supported one is used
+const TransformKernelInfo transform_kernels[] = {
+  { "scalar", transformScalar, alwaysSupported },
+#ifdef HAVE_X86_TRANSFORMS
+  { "sse", transformSSE, alwaysSupported },
+  { "avx2", transformAVX2, avx2Supported },
+#endif
+};
+const int NUM_TRANSFORM_KERNELS = sizeof(transform_kernels) / sizeof(transform_kernels[0]);
+
+const TransformKernelInfo &selectTransformKernel ()
+{
+  static int selected = -1;
+  if (selected < 0) {
+    for (selected = NUM_TRANSFORM_KERNELS - 1; selected > 0; selected--)
+      if (transform_kernels[selected].supported())
+        break;
+  }
+  return transform_kernels[selected];
+}
+
+/* Fill out[0..count) with the model matrices of instances [first, first+count) */
+void transformBatch (const TransformBatch &batch, size_t first, size_t count, glm::mat4 *out)
 {
-  glfwDestroyWindow(window);
-  glfwTerminate();
-  exit(EXIT_SUCCESS);
+  selectTransformKernel().kernel(batch, first, count, out);
 }
 
-
-/* Generate VAO, VBOs and return VAO handle */
-struct VAO* create3DObject (GLenum primitive_mode, int numVertices, const GLfloat* vertex_buffer_data, const GLfloat* color_buffer_data, GLenum fill_mode=GL_FILL)
+/* --transform-bench [N]: time N random instances through glm and every
+   kernel this CPU supports, check them against glm and exit */
+int benchmarkTransforms (size_t instances)
 {
-  struct VAO* vao = new struct VAO;
-  vao->PrimitiveMode = primitive_mode;
-  vao->NumVertices = numVertices;
-  vao->FillMode = fill_mode;
-
-    // Create Vertex Array Object
-    // Should be done after CreateWindow and before any other GL calls
-    glGenVertexArrays(1, &(vao->VertexArrayID)); // VAO
-    glGenBuffers (1, &(vao->VertexBuffer)); // VBO - vertices
-    glGenBuffers (1, &(vao->ColorBuffer));  // VBO - colors
-
-    glBindVertexArray (vao->VertexArrayID); // Bind the VAO 
-    glBindBuffer (GL_ARRAY_BUFFER, vao->VertexBuffer); // Bind the VBO vertices 
-    glBufferData (GL_ARRAY_BUFFER, 3*numVertices*sizeof(GLfloat), vertex_buffer_data, GL_STATIC_DRAW); // Copy the vertices into VBO
-    glVertexAttribPointer(
-                          0,                  // attribute 0. Vertices
-                          3,                  // size (x,y,z)
-                          GL_FLOAT,           // type
-                          GL_FALSE,           // normalized?
-                          0,                  // stride
-                          (void*)0            // array buffer offset
-                          );
-
-    glBindBuffer (GL_ARRAY_BUFFER, vao->ColorBuffer); // Bind the VBO colors 
-    glBufferData (GL_ARRAY_BUFFER, 3*numVertices*sizeof(GLfloat), color_buffer_data, GL_STATIC_DRAW);  // Copy the vertex colors
-    glVertexAttribPointer(
-                          1,                  // attribute 1. Color
-                          3,                  // size (r,g,b)
-                          GL_FLOAT,           // type
-                          GL_FALSE,           // normalized?
-                          0,                  // stride
-                          (void*)0            // array buffer offset
-                          );
-
-    return vao;
+  TransformBatch batch;
+  batch.resize(instances);
+  std::mt19937 rng(0x5eed);
+  auto uniform = [&] (float lo, float hi) { return std::uniform_real_distribution<float>(lo, hi)(rng); };
+  for (size_t i = 0; i < instances; i++) {
+    glm::vec3 axis = glm::normalize(glm::vec3(uniform(-1, 1), uniform(-1, 1), uniform(-1, 1)) + glm::vec3(0, 0, 1e-3f));
+    batch.set(i, glm::vec3(uniform(-10, 10), uniform(-10, 10), uniform(-10, 10)),
+              glm::angleAxis(uniform(0, 2 * M_PI), axis),
+              glm::vec3(uniform(.1f, 2), uniform(.1f, 2), uniform(.1f, 2)));
   }
 
-/* Generate VAO, VBOs and return VAO handle - Common Color for all vertices */
-  struct VAO* create3DObject (GLenum primitive_mode, int numVertices, const GLfloat* vertex_buffer_data, const GLfloat red, const GLfloat green, const GLfloat blue, GLenum fill_mode=GL_FILL)
-  {
-    GLfloat* color_buffer_data = new GLfloat [3*numVertices];
-    for (int i=0; i<numVertices; i++) {
-      color_buffer_data [3*i] = red;
-      color_buffer_data [3*i + 1] = green;
-      color_buffer_data [3*i + 2] = blue;
+  const int REPEATS = 20;
+  std::vector<glm::mat4> expected(instances), out(instances);
+  auto time = [&] (const std::function<void ()> &run) {
+    double best = 1e30;
+    for (int r = 0; r < REPEATS; r++) {
+      auto start = std::chrono::steady_clock::now();
+      run();
+      best = std::min(best, std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count());
     }
+    return best / instances;
+  };
 
-    return create3DObject(primitive_mode, numVertices, vertex_buffer_data, color_buffer_data, fill_mode);
+  double glm_ns = time([&] {
+    for (size_t i = 0; i < instances; i++)
+      expected[i] = glm::translate(glm::vec3(batch.tx[i], batch.ty[i], batch.tz[i]))
+                  * glm::mat4_cast(glm::quat(batch.qw[i], batch.qx[i], batch.qy[i], batch.qz[i]))
+                  * glm::scale(glm::vec3(batch.sx[i], batch.sy[i], batch.sz[i]));
+  });
+  printf("%zu instances, best of %d runs, kernel in use: %s\n", instances, REPEATS, selectTransformKernel().name);
+  printf("glm    : %6.2f ns per instance\n", glm_ns);
+
+  int status = EXIT_SUCCESS;
+  for (int k = 0; k < NUM_TRANSFORM_KERNELS; k++) {
+    const TransformKernelInfo &info = transform_kernels[k];
+    if (!info.supported())
+      continue;
+    double ns = time([&] { info.kernel(batch, 0, instances, &out[0]); });
+    float error = 0;
+    for (size_t i = 0; i < instances; i++)
+      for (int c = 0; c < 4; c++)
+        for (int r = 0; r < 4; r++)
+          error = std::max(error, std::fabs(out[i][c][r] - expected[i][c][r]));
+    printf("%-7s: %6.2f ns per instance (%.1fx glm), max error %g\n", info.name, ns, glm_ns / ns, error);
+    if (error > 1e-4f)
+      status = EXIT_FAILURE;
   }
+  return status;
+}
 
-/* Render the VBOs handled by VAO */
-  void draw3DObject (struct VAO* vao)
-  {
-    // Change the Fill Mode for this object
-    glPolygonMode (GL_FRONT_AND_BACK, vao->FillMode);
-
-    // Bind the VAO to use
-    glBindVertexArray (vao->VertexArrayID);
-
-    // Enable Vertex Attribute 0 - 3d Vertices
-    glEnableVertexAttribArray(0);
-    // Bind the VBO to use
-    glBindBuffer(GL_ARRAY_BUFFER, vao->VertexBuffer);
 
-    // Enable Vertex Attribute 1 - Color
-    glEnableVertexAttribArray(1);
-    // Bind the VBO to use
-    glBindBuffer(GL_ARRAY_BUFFER, vao->ColorBuffer);
+/* The four borders stand on the board's edges: each is rotated a quarter
+   turn about `axis` and then moved by `offset` in the rotated frame. Their
+   model matrices never change, so they are built once at startup. */
+struct BorderPlacement { glm::vec3 axis, offset; };
+const BorderPlacement BORDER_PLACEMENTS[4] = {
+  { glm::vec3(0, 1, 0), glm::vec3(0, 5, 0) },
+  { glm::vec3(0, 1, 0), glm::vec3(0, -6, .5) },
+  { glm::vec3(1, 0, 0), glm::vec3(6, 0, 0) },
+  { glm::vec3(1, 0, 0), glm::vec3(-5, 0, 0) },
+};
+const int LEFT_BORDER = 3; // the player moves in this border's frame
+glm::mat4 border_models[4];
 
-    // Draw the geometry !
-    glDrawArrays(vao->PrimitiveMode, 0, vao->NumVertices); // Starting from vertex 0; 3 vertices total -> 1 triangle
+void buildBorderModels ()
+{
+  TransformBatch batch;
+  batch.resize(4);
+  for (int i = 0; i < 4; i++) {
+    glm::quat rotation = glm::angleAxis((float) (M_PI / 2), BORDER_PLACEMENTS[i].axis);
+    batch.set(i, rotation * BORDER_PLACEMENTS[i].offset, rotation, glm::vec3(1));
   }
+  transformBatch(batch, 0, 4, border_models);
+}
 
 /**************************
  * Customizable functions *
  **************************/
 
- float triangle_rot_dir = 1;
- float rectangle_rot_dir = 1;
- bool triangle_rot_status = true;
- bool rectangle_rot_status = true;
- float x_man, y_men;
- bool initial = true;
  bool change = false;
 
+/* Input events are handed from the GLFW callbacks (main thread, inside
+   glfwPollEvents) to the simulation, which owns the entities and
+   change. Each event carries the glfwGetTime() at which GLFW delivered it. */
+ enum InputEventType { INPUT_KEY, INPUT_MOUSE_BUTTON };
+
+ struct InputEvent {
+  double time;
+  int type;
+  int code;   // GLFW key or mouse button
+  int action; // GLFW_PRESS / GLFW_RELEASE
+ };
+
+/* Bounded single-producer single-consumer ring. push() is only called by
+   the thread polling GLFW events and pop() only by the thread running
+   tick(); head and tail live on separate cache lines so the two sides do
+   not false-share. */
+ template <class T, unsigned N>
+ class SpscRing {
+  static_assert((N & (N - 1)) == 0, "ring size must be a power of two");
+  T items[N];
+  alignas(64) std::atomic<unsigned> head; // next slot to read
+  alignas(64) std::atomic<unsigned> tail; // next slot to write
+ public:
+  SpscRing() : head(0), tail(0) {}
+
+  // Returns false (and drops the item) when the ring is full
+  bool push (const T &item)
+  {
+    unsigned t = tail.load(std::memory_order_relaxed);
+    if (t - head.load(std::memory_order_acquire) == N)
+      return false;
+    items[t & (N - 1)] = item;
+    tail.store(t + 1, std::memory_order_release);
+    return true;
+  }
+
+  bool pop (T &item)
+  {
+    unsigned h = head.load(std::memory_order_relaxed);
+    if (h == tail.load(std::memory_order_acquire))
+      return false;
+    item = items[h & (N - 1)];
+    head.store(h + 1, std::memory_order_release);
+    return true;
+  }
+ };
+
+ SpscRing<InputEvent, 256> input_events;
+ unsigned long dropped_input_events = 0;
+
+/* Delivery-to-application latency of input events, for reporting */
+ struct InputLatency {
+  unsigned long count;
+  double total, worst;
+ } input_latency;
+
+ void pushInput (int type, int code, int action)
+ {
+  InputEvent event = { glfwGetTime(), type, code, action };
+  if (!input_events.push(event))
+    dropped_input_events++;
+ }
+
 /* Executed when a regular key is pressed/released/held-down */
 /* Prefered for Keyboard events */
  void keyboard (GLFWwindow* window, int key, int scancode, int action, int mods)
@@ -219,23 +1936,11 @@ struct VAO* create3DObject (GLenum primitive_mode, int numVertices, const GLfloa
   if (action == GLFW_RELEASE) {
     switch (key) {
       case GLFW_KEY_RIGHT:
-      x_man += .5;
-      initial = false;
-      break;
       case GLFW_KEY_LEFT:
-      x_man -= .5;
-      initial = false;
-      break;
       case GLFW_KEY_UP:
-      y_men -= .5;
-      initial = false;
-      break;
       case GLFW_KEY_DOWN:
-      y_men += .5;
-      initial = false;
-      break;
       case GLFW_KEY_C:
-      change = !change;
+      pushInput(INPUT_KEY, key, action);
       break;
       default:
       break;
@@ -246,6 +1951,10 @@ struct VAO* create3DObject (GLenum primitive_mode, int numVertices, const GLfloa
       case GLFW_KEY_ESCAPE:
       quit(window);
       break;
+      case GLFW_KEY_M:
+      reportMemoryUsage();
+      reportGpuResources();
+      break;
       default:
       break;
     }
@@ -270,13 +1979,9 @@ void mouseButton (GLFWwindow* window, int button, int action, int mods)
 {
   switch (button) {
     case GLFW_MOUSE_BUTTON_LEFT:
-    if (action == GLFW_RELEASE)
-      triangle_rot_dir *= -1;
-    break;
     case GLFW_MOUSE_BUTTON_RIGHT:
-    if (action == GLFW_RELEASE) {
-      rectangle_rot_dir *= -1;
-    }
+    if (action == GLFW_RELEASE)
+      pushInput(INPUT_MOUSE_BUTTON, button, action);
     break;
     default:
     break;
@@ -284,6 +1989,8 @@ void mouseButton (GLFWwindow* window, int button, int action, int mods)
 }
 
 
+int viewport_width = 1, viewport_height = 1; // framebuffer pixels
+
 /* Executed when window is resized to 'width' and 'height' */
 /* Modify the bounds of the screen here in glm::ortho or Field of View in glm::Perspective */
 void reshapeWindow (GLFWwindow* window, int width, int height)
@@ -297,6 +2004,8 @@ void reshapeWindow (GLFWwindow* window, int width, int height)
 
 	// sets the viewport of openGL renderer
   glViewport (0, 0, (GLsizei) fbwidth, (GLsizei) fbheight);
+  viewport_width = fbwidth;
+  viewport_height = fbheight;
 
 	// set the projection matrix as perspective
 	/* glMatrixMode (GL_PROJECTION);
@@ -304,31 +2013,108 @@ void reshapeWindow (GLFWwindow* window, int width, int height)
 	   gluPerspective (fov, (GLfloat) fbwidth / (GLfloat) fbheight, 0.1, 500.0); */
 	// Store the projection matrix in a variable for future use
     // Perspective projection for 3D views
-     Matrices.projection = glm::perspective (fov, (GLfloat) fbwidth / (GLfloat) fbheight, 0.1f, 500.0f);
-
-    // Ortho projection for 2D views
-    // Matrices.projection = glm::ortho(-4.0f, 4.0f, -4.0f, 4.0f, 0.1f, 500.0f);
+     camera.perspective (fov, (GLfloat) fbwidth / (GLfloat) fbheight, 0.1f, 500.0f);
    }
 
-   VAO *triangle, *rectangle, *border, *circle, *line;
+   MeshHandle triangle, rectangle, border, circle, line;
 
-// Creates the triangle object used in this sample code
-   void createSquare()
-   {
-  /* ONLY vertices between the bounds specified in glm::ortho will be visible on screen */
-
-  /* Define vertex array as used in glBegin (GL_TRIANGLES) */
-    static const GLfloat vertex_buffer_data [] = {
-    // first face
-      -0.5, -0.5, 0,
-      -0.5,  0.5, 0,
-      0.5,  0.5, 0,
-      0.5,  0.5, 0,
-      0.5,  -0.5, 0,
-      -0.5, -0.5, 0,
-    };
-
-    static const GLfloat color_buffer_data [] = {
+/**************************
+ * Geometry generators    *
+ **************************/
+
+/* Everything below is evaluated by the compiler: the meshes end up as
+   constant data in the binary and nothing is computed at startup. */
+
+constexpr double CT_PI = 3.14159265358979323846;
+
+// sin/cos usable in constant expressions (std::sin is not constexpr)
+constexpr double ctSin (double x)
+{
+  while (x > CT_PI) x -= 2 * CT_PI;
+  while (x < -CT_PI) x += 2 * CT_PI;
+  double term = x, sum = x;
+  for (int n = 1; n < 12; n++) {
+    term *= -x * x / ((2 * n) * (2 * n + 1));
+    sum += term;
+  }
+  return sum;
+}
+
+constexpr double ctCos (double x)
+{
+  return ctSin(x + CT_PI / 2);
+}
+
+/* Fan around the rim of a circle in the z plane, `segments` vertices */
+template<int segments>
+constexpr std::array<GLfloat, 3*segments> circleVertices (double radius, GLfloat z)
+{
+  std::array<GLfloat, 3*segments> v {};
+  for (int k = 0; k < segments; k++) {
+    double angle = 2 * CT_PI * k / segments;
+    v[3*k] = (GLfloat) (radius * ctCos(angle));
+    v[3*k+1] = (GLfloat) (radius * ctSin(angle));
+    v[3*k+2] = z;
+  }
+  return v;
+}
+
+/* The same color for every vertex */
+template<int vertices>
+constexpr std::array<GLfloat, 3*vertices> solidColors (GLfloat r, GLfloat g, GLfloat b)
+{
+  std::array<GLfloat, 3*vertices> c {};
+  for (int k = 0; k < vertices; k++) {
+    c[3*k] = r;
+    c[3*k+1] = g;
+    c[3*k+2] = b;
+  }
+  return c;
+}
+
+/* Two triangles spanning [-hx,hx] x [-hy,hy] in the z plane */
+constexpr std::array<GLfloat, 18> quadVertices (GLfloat hx, GLfloat hy, GLfloat z)
+{
+  return {{ -hx, -hy, z,  -hx, hy, z,  hx, hy, z,
+            hx, hy, z,  hx, -hy, z,  -hx, -hy, z }};
+}
+
+// Corner signs of the 36 box vertices: faces -z, +z, +x, -x, +y, -y
+constexpr signed char BOX_CORNERS[36][3] = {
+  {-1,-1,-1}, {-1, 1,-1}, { 1, 1,-1}, { 1, 1,-1}, { 1,-1,-1}, {-1,-1,-1},
+  { 1,-1, 1}, { 1, 1, 1}, {-1, 1, 1}, {-1, 1, 1}, {-1,-1, 1}, { 1,-1, 1},
+  { 1,-1,-1}, { 1, 1,-1}, { 1, 1, 1}, { 1, 1, 1}, { 1,-1, 1}, { 1,-1,-1},
+  {-1,-1, 1}, {-1, 1, 1}, {-1, 1,-1}, {-1, 1,-1}, {-1,-1,-1}, {-1,-1, 1},
+  { 1, 1, 1}, { 1, 1,-1}, {-1, 1,-1}, {-1, 1,-1}, {-1, 1, 1}, { 1, 1, 1},
+  { 1,-1,-1}, { 1,-1, 1}, {-1,-1, 1}, {-1,-1, 1}, {-1,-1,-1}, { 1,-1,-1},
+};
+
+/* Box spanning [-hx,hx] x [-hy,hy] x [-hz,hz] as 12 triangles */
+constexpr std::array<GLfloat, 108> boxVertices (GLfloat hx, GLfloat hy, GLfloat hz)
+{
+  std::array<GLfloat, 108> v {};
+  for (int k = 0; k < 36; k++) {
+    v[3*k] = BOX_CORNERS[k][0] * hx;
+    v[3*k+1] = BOX_CORNERS[k][1] * hy;
+    v[3*k+2] = BOX_CORNERS[k][2] * hz;
+  }
+  return v;
+}
+
+/* One color per box face, in boxVertices face order */
+constexpr std::array<GLfloat, 108> boxFaceColors (const GLfloat (&faces)[6][3])
+{
+  std::array<GLfloat, 108> c {};
+  for (int k = 0; k < 36; k++)
+    for (int i = 0; i < 3; i++)
+      c[3*k+i] = faces[k / 6][i];
+  return c;
+}
+
+/* ONLY vertices between the bounds specified in glm::ortho will be visible on screen */
+static constexpr auto square_vertices = quadVertices(.5, .5, 0);
+
+static const GLfloat square_colors [] = {
     0.3424,0.242,0.24234, // color 1
     0.2424,0.2344,0.242, // color 2
     0.2424,0.2424,0.3424, // color 3
@@ -336,378 +2122,958 @@ void reshapeWindow (GLFWwindow* window, int width, int height)
     0.2424,0.2424,0.3424, // color 3
     0.213123,0.6788,0.44456, // color 4
     0.3424,0.242,0.24234, // color 1
-  };
+};
 
+// Creates the triangle object used in this sample code
+   void createSquare()
+   {
   // create3DObject creates and returns a handle to a VAO that can be used later
-  triangle = create3DObject(GL_TRIANGLES, 6, vertex_buffer_data, color_buffer_data, GL_FILL);
+  triangle = create3DObject(GL_TRIANGLES, 6, square_vertices.data(), square_colors, GL_FILL);
 }
 
+const GLfloat CUBOID_FACE_COLORS[6][3] = {
+  {1,0,0}, {0,1,0}, {0,0,1}, {.2,.2,.2}, {0.5,0.5,0.5}, {0.9,0.9,0.9},
+};
+
+static constexpr auto cuboid_vertices = boxVertices(.45, .45, .45);
+static constexpr auto cuboid_colors = boxFaceColors(CUBOID_FACE_COLORS);
+
 // Creates the rectangle object used in this sample code
 void createCuboid()
 {
-  /* ONLY vertices between the bounds specified in glm::ortho will be visible on screen */
-
-  /* Define vertex array as used in glBegin (GL_TRIANGLES) */
-  static const GLfloat vertex_buffer_data [] = {
-    // first face
-    -0.45, -0.45, -.45,
-    -0.45,  0.45, -.45,
-    0.45,  0.45, -.45,
-    0.45,  0.45, -.45,
-    0.45,  -0.45, -.45,
-    -0.45, -0.45, -.45,
-
-    // second face
-    0.45, -0.45, .45,
-    0.45,  0.45, .455,
-    -0.45,  0.45, .45,
-    -0.45,  0.45, .45,
-    -0.45, -0.45, .45,
-    0.45, -0.45, .45,
-
-    // third face
-    0.45, -0.45, -.45,
-    0.45,  0.45, -.45,
-    0.45,  0.45,  .45,
-    0.45,  0.45,  .45,
-    0.45, -0.45,  .45,
-    0.45, -0.45, -.45,
-
-    // fourth face
-    -0.45, -0.45,  .45,
-    -0.45,  0.45,  .45,
-    -0.45,  0.45, -.45,
-    -0.45,  0.45, -.45,
-    -0.45, -0.45, -.45,
-    -0.45, -0.45,  .45,
-
-    // fifth face
-    0.45,  0.45,  .45,
-    0.45,  0.45, -.45,
-    -0.45,  0.45, -.45,
-    -0.45,  0.45, -.45,
-    -0.45,  0.45,  .45,
-    0.45,  0.45,  .45,
-
-    // sixth face
-    0.45, -0.45, -.45,
-    0.45, -0.45,  .45,
-    -0.45, -0.45,  .45,
-    -0.45, -0.45,  .45,
-    -0.45, -0.45, -.45,
-    0.45, -0.45, -.45,
-  };
+  // create3DObject creates and returns a handle to a VAO that can be used later
+  rectangle = create3DObject(GL_TRIANGLES, 36, cuboid_vertices.data(), cuboid_colors.data(), GL_FILL);
+}
+
+const GLfloat BORDER_FACE_COLORS[6][3] = {
+  {.2,.2,.2}, {.2,.2,.2}, {.2,.2,.2}, {.2,.2,.2}, {.2,.2,.2}, {.2,.2,.2},
+};
 
-  static const GLfloat color_buffer_data [] = {
-    1,0,0, // color 1
-    1,0,0, // color 2
-    1,0,0, // color 3
+// Long bar running along the board edge; placed by BORDER_PLACEMENTS
+constexpr GLfloat BORDER_HALF_EXTENTS[3] = { .5, .5, 5.5 };
+static constexpr auto border_vertices = boxVertices(BORDER_HALF_EXTENTS[0], BORDER_HALF_EXTENTS[1], BORDER_HALF_EXTENTS[2]);
+static constexpr auto border_colors = boxFaceColors(BORDER_FACE_COLORS);
 
-    1,0,0, // color 3
-    1,0,0, // color 4
-    1,0,0,  // color 1
+void createBorder()
+{
+  border = create3DObject(GL_TRIANGLES, 36, border_vertices.data(), border_colors.data(), GL_FILL);
+}
+
+const int CIRCLE_SEGMENTS = 100;
+constexpr GLfloat CIRCLE_RADIUS = .2, CIRCLE_Z = .2;
+static constexpr auto circle_vertices = circleVertices<CIRCLE_SEGMENTS>(CIRCLE_RADIUS, CIRCLE_Z);
+static constexpr auto circle_colors = solidColors<CIRCLE_SEGMENTS>(.78, .2323, .321);
+
+/* Level of detail for round meshes: drawCircle() picks the first entry
+   whose min_radius_px the projected radius reaches. Anything smaller than
+   DISC_SPRITE_MAX_PX is drawn as one point sprite cut to a disc by
+   Disc.frag instead of a fan. */
+struct RoundLod {
+  int segments;
+  float min_radius_px;
+  MeshHandle mesh;
+};
+
+RoundLod circle_lods[] = {
+  { CIRCLE_SEGMENTS, 40, MeshHandle() },
+  { 32, 10, MeshHandle() },
+  { 12, 0, MeshHandle() },
+};
+const int NUM_CIRCLE_LODS = sizeof(circle_lods) / sizeof(circle_lods[0]);
+const float DISC_SPRITE_MAX_PX = 3;
+
+static const GLfloat disc_vertex [] = { 0, 0, CIRCLE_Z };
+MeshHandle disc_marker;
+GpuHandle disc_program;
+GLint disc_mvp_id, disc_size_id;
+
+template<int segments>
+MeshHandle createCircleLod ()
+{
+  static constexpr auto vertices = circleVertices<segments>(CIRCLE_RADIUS, CIRCLE_Z);
+  static constexpr auto colors = solidColors<segments>(.78, .2323, .321);
+  return create3DObject(GL_TRIANGLE_FAN, segments, vertices.data(), colors.data(), GL_FILL);
+}
+
+void createCircle()
+{
+  circle = create3DObject(GL_TRIANGLE_FAN, CIRCLE_SEGMENTS, circle_vertices.data(), circle_colors.data(), GL_FILL);
+}
+
+/* The lower tessellations and the point sprite; circle (possibly from a
+   level pack) stays the finest level */
+void createCircleLods()
+{
+  circle_lods[0].mesh = circle;
+  circle_lods[1].mesh = createCircleLod<32>();
+  circle_lods[2].mesh = createCircleLod<12>();
+  disc_marker = create3DObject(GL_POINTS, 1, disc_vertex, circle_colors.data(), GL_FILL);
+}
 
-    0,1,0, // color 1
-    0,1,0, // color 2
-    0,1,0, // color 3
+// Only the first edge of a 1x1x3 box is drawn, as GL_LINES
+static const GLfloat line_vertices [] = {
+    -0.5, -0.5, -1.5,
+    -0.5,  0.5, -1.5,
+};
 
-    0,1,0, // color 3
-    0,1,0, // color 4
-    0,1,0,  // color 1
+static constexpr auto line_colors = solidColors<2>(.78, .2323, .321);
 
-    0,0,1, // color 1
-    0,0,1, // color 2
-    0,0,1, // color 3
+void createLine()
+{
+  line = create3DObject(GL_LINES, 2, line_vertices, line_colors.data(), GL_FILL);
+}
 
-    0,0,1, // color 3
-    0,0,1, // color 4
-    0,0,1,  // color 1
+/* The built-in meshes by name, as the level pack refers to them */
+struct BuiltinMesh {
+  const char *name;
+  GLenum primitive;
+  int num_vertices;
+  const GLfloat *vertices, *colors;
+  MeshHandle *target;
+};
 
-    .2,.2,.2, // color 1
-    .2,.2,.2, // color 2
-    .2,.2,.2, // color 3
+const BuiltinMesh builtin_meshes[] = {
+  { "square", GL_TRIANGLES, 6, square_vertices.data(), square_colors, &triangle },
+  { "cuboid", GL_TRIANGLES, 36, cuboid_vertices.data(), cuboid_colors.data(), &rectangle },
+  { "border", GL_TRIANGLES, 36, border_vertices.data(), border_colors.data(), &border },
+  { "circle", GL_TRIANGLE_FAN, CIRCLE_SEGMENTS, circle_vertices.data(), circle_colors.data(), &circle },
+  { "line", GL_LINES, 2, line_vertices, line_colors.data(), &line },
+};
+const int NUM_BUILTIN_MESHES = sizeof(builtin_meshes) / sizeof(builtin_meshes[0]);
 
-    .2,.2,.2, // color 3
-    .2,.2,.2, // color 4
-    .2,.2,.2, // color 1
+/**************************
+ * Level packs            *
+ **************************/
 
-    0.5,0.5,0.5, // color 1
-    0.5,0.5,0.5, // color 2
-    0.5,0.5,0.5, // color 3
+/* A level pack is a versioned little endian file holding meshes and
+   boards. It is mmap'ed and uploaded to GL straight from the mapping.
+   Every section starts on a PACK_ALIGN boundary:
+
+     PackHeader
+     PackMesh[mesh_count]         mesh table
+     MeshVertex[vertex_count]     interleaved positions and colors
+     uint32_t[index_count]        indices, relative to the mesh's first vertex
+     uint64_t[2 * board_count]    boards, packed like board_bits
+*/
+const uint32_t PACK_VERSION = 1;
+const uint64_t PACK_ALIGN = 64;
+
+// Packs are written and read in host byte order, straight from memory
+static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__, "level packs are little endian; big endian hosts are not supported");
+
+struct PackHeader {
+  char magic[4]; // "GLPK"
+  uint32_t version;
+  uint32_t mesh_count, board_count;
+  uint64_t vertex_count, index_count;
+  uint64_t mesh_offset, vertex_offset, index_offset, board_offset;
+  uint64_t file_size;
+};
 
-    0.5,0.5,0.5, // color 3
-    0.5,0.5,0.5, // color 4
-    0.5,0.5,0.5, // color 1
+struct PackMesh {
+  char name[16];
+  uint32_t primitive;
+  uint32_t first_vertex, vertex_count;
+  uint32_t first_index, index_count;
+};
 
-    0.9,0.9,0.9, // color 1
-    0.9,0.9,0.9, // color 2
-    0.9,0.9,0.9, // color 3
+struct LevelPack {
+  void *mapping;
+  size_t size;
+  const PackHeader *header;
+  const PackMesh *meshes;
+  const MeshVertex *vertices;
+  const uint32_t *indices;
+  const uint64_t *boards;
+  uint32_t board_count;
+} level_pack;
 
-    0.9,0.9,0.9, // color 3
-    0.9,0.9,0.9, // color 4
-    0.9,0.9,0.9, // color 1
-  };
+unsigned level_index = 0; // next pack board to play
 
-  // create3DObject creates and returns a handle to a VAO that can be used later
-  rectangle = create3DObject(GL_TRIANGLES, 36, vertex_buffer_data, color_buffer_data, GL_FILL);
+inline uint64_t packAlign (uint64_t offset)
+{
+  return (offset + PACK_ALIGN - 1) & ~(PACK_ALIGN - 1);
 }
 
-void createBorder()
+bool packSectionValid (uint64_t offset, uint64_t count, uint64_t item_size, uint64_t file_size)
 {
-  /* ONLY vertices between the bounds specified in glm::ortho will be visible on screen */
-
-  /* Define vertex array as used in glBegin (GL_TRIANGLES) */
-  static const GLfloat vertex_buffer_data [] = {
-    // first face
-    -0.5, -0.5, -5.5,
-    -0.5,  0.5, -5.5,
-    0.5,  0.5, -5.5,
-    0.5,  0.5, -5.5,
-    0.5,  -0.5, -5.5,
-    -0.5, -0.5, -5.5,
-
-    // second face
-    0.5, -0.5, 5.5,
-    0.5,  0.5, 5.5,
-    -0.5,  0.5, 5.5,
-    -0.5,  0.5, 5.5,
-    -0.5, -0.5, 5.5,
-    0.5, -0.5, 5.5,
-
-    // third face
-    0.5, -0.5, -5.5,
-    0.5,  0.5, -5.5,
-    0.5,  0.5,  5.5,
-    0.5,  0.5,  5.5,
-    0.5, -0.5,  5.5,
-    0.5, -0.5, -5.5,
-
-    // fourth face
-    -0.5, -0.5,  5.5,
-    -0.5,  0.5,  5.5,
-    -0.5,  0.5, -5.5,
-    -0.5,  0.5, -5.5,
-    -0.5, -0.5, -5.5,
-    -0.5, -0.5,  5.5,
-
-    // fifth face
-    0.5,  0.5,  5.5,
-    0.5,  0.5, -5.5,
-    -0.5,  0.5, -5.5,
-    -0.5,  0.5, -5.5,
-    -0.5,  0.5,  5.5,
-    0.5,  0.5,  5.5,
-
-    // sixth face
-    0.5, -0.5, -5.5,
-    0.5, -0.5,  5.5,
-    -0.5, -0.5,  5.5,
-    -0.5, -0.5,  5.5,
-    -0.5, -0.5, -5.5,
-    0.5, -0.5, -5.5,
-  };
+  return offset % PACK_ALIGN == 0 && offset <= file_size && count <= (file_size - offset) / item_size;
+}
+
+/* Map and validate a level pack; returns false and maps nothing if the file
+   is missing or malformed */
+bool openLevelPack (const char *path)
+{
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    fprintf(stderr, "Cannot open level pack %s\n", path);
+    return false;
+  }
+  struct stat st;
+  void *mapping = MAP_FAILED;
+  if (fstat(fd, &st) == 0 && st.st_size >= (off_t) sizeof(PackHeader))
+    mapping = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED) {
+    fprintf(stderr, "Cannot map level pack %s\n", path);
+    return false;
+  }
+
+  const char *base = (const char *) mapping;
+  const PackHeader *header = (const PackHeader *) base;
+  uint64_t size = st.st_size;
+  bool valid = !memcmp(header->magic, "GLPK", 4) && header->version == PACK_VERSION && header->file_size == size
+    && packSectionValid(header->mesh_offset, header->mesh_count, sizeof(PackMesh), size)
+    && packSectionValid(header->vertex_offset, header->vertex_count, sizeof(MeshVertex), size)
+    && packSectionValid(header->index_offset, header->index_count, sizeof(uint32_t), size)
+    && packSectionValid(header->board_offset, header->board_count, 2 * sizeof(uint64_t), size);
+
+  const PackMesh *meshes = (const PackMesh *) (base + header->mesh_offset);
+  const uint32_t *indices = (const uint32_t *) (base + header->index_offset);
+  for (uint32_t m = 0; valid && m < header->mesh_count; m++) {
+    const PackMesh &mesh = meshes[m];
+    valid = memchr(mesh.name, 0, sizeof(mesh.name)) != NULL
+      && (uint64_t) mesh.first_vertex + mesh.vertex_count <= header->vertex_count
+      && (uint64_t) mesh.first_index + mesh.index_count <= header->index_count;
+    for (uint32_t i = 0; valid && i < mesh.index_count; i++)
+      valid = indices[mesh.first_index + i] < mesh.vertex_count;
+  }
+  if (!valid) {
+    fprintf(stderr, "%s is not a valid version %u level pack\n", path, PACK_VERSION);
+    munmap(mapping, size);
+    return false;
+  }
+
+  level_pack.mapping = mapping;
+  level_pack.size = size;
+  level_pack.header = header;
+  level_pack.meshes = meshes;
+  level_pack.vertices = (const MeshVertex *) (base + header->vertex_offset);
+  level_pack.indices = indices;
+  level_pack.boards = (const uint64_t *) (base + header->board_offset);
+  level_pack.board_count = header->board_count;
+  countAllocation(heap_memory[MEM_LEVEL_PACK], size);
+  printf("Level pack %s: %u meshes, %u boards\n", path, header->mesh_count, header->board_count);
+  return true;
+}
+
+void closeLevelPack ()
+{
+  if (level_pack.mapping) {
+    munmap(level_pack.mapping, level_pack.size);
+    countFree(heap_memory[MEM_LEVEL_PACK], level_pack.size);
+  }
+  memset(&level_pack, 0, sizeof(level_pack));
+}
+
+/* Create the VAOs for every built-in mesh the pack provides, uploading
+   directly from the mapping. Meshes it lacks are left NULL. */
+void uploadPackMeshes ()
+{
+  if (!level_pack.header)
+    return;
+  for (uint32_t m = 0; m < level_pack.header->mesh_count; m++) {
+    const PackMesh &mesh = level_pack.meshes[m];
+    for (int b = 0; b < NUM_BUILTIN_MESHES; b++)
+      if (!strcmp(mesh.name, builtin_meshes[b].name) && !*builtin_meshes[b].target)
+        *builtin_meshes[b].target = create3DObjectIndexed(mesh.primitive, mesh.vertex_count, level_pack.vertices + mesh.first_vertex,
+                                                          mesh.index_count, level_pack.indices + mesh.first_index, GL_FILL);
+  }
+}
+
+float camera_rotation_angle = 90;
+float rectangle_rotation = 0;
+float triangle_rotation = 0;
+bool flag = true;
+uint64_t board_bits[2]; // the current board, one bit per cell, row major
+int vibration=1, prev_vibration=1;
+
+/* Game rules, shared by tick() and the headless playouts so both judge
+   games identically. Positions are in half-cell units (twice the agent's
+   x and y) so they stay exact integers. */
+enum GameOutcome { GAME_ONGOING, GAME_WIN, GAME_LOSE };
+
+inline bool boardCell (uint64_t lo, uint64_t hi, int i, int j)
+{
+  int n = i * 10 + j;
+  return n < 64 ? (lo >> n) & 1 : (hi >> (n - 64)) & 1;
+}
+
+/* Fill a 10x10 board and knock holes_per_row random cells out of every
+   row; a cell on the diagonal is never removed. holes_per_row = 1 is the
+   board the game has always used. */
+template <class Rng>
+void generateBoard (uint64_t board[2], int holes_per_row, Rng &next)
+{
+  board[0] = ~0ULL;
+  board[1] = (1ULL << 36) - 1;
+  for (int i = 0 ; i < 10 ; i++)
+  {
+    for (int h = 0 ; h < holes_per_row ; h++)
+    {
+      int a = next() % 10;
+      int n = i * 10 + a;
+      if (a != i)
+        board[n >> 6] &= ~(1ULL << (n & 63));
+    }
+  }
+}
+
+/* Judge the player standing at (hx, hy) after a move. Leaving the board
+   ends the game (a win only past the far corner), reaching the far corner
+   wins and standing exactly on a removed cell loses. */
+inline int judgePosition (int hx, int hy, uint64_t lo, uint64_t hi)
+{
+  if (hx > 19 || hx < 2 || hy < -9 || hy > 9)
+    return (hx >= 18 && hy <= -8) ? GAME_WIN : GAME_LOSE;
+  if (hx == 19 && hy == -9)
+    return GAME_WIN;
+  if (!(hx & 1) && !(hy & 1) && hy >= 0 && !boardCell(lo, hi, hx / 2, hy / 2))
+    return GAME_LOSE;
+  return GAME_ONGOING;
+}
+
+/* Game objects as entities: each component is its own array indexed by
+   entity, and each kind (the board's tiles, the blocks standing on them,
+   the agents walking over them) is one contiguous run, so every system
+   below is a linear loop over a few arrays. Owned by the simulation;
+   draw() only sees the render list built from it into each snapshot. */
+enum EntityKind { ENTITY_TILE, ENTITY_BLOCK, ENTITY_AGENT, NUM_ENTITY_KINDS };
+enum EntityState { ENTITY_PRESENT = 1, ENTITY_REVERSED = 2, ENTITY_AT_START = 4 };
+
+struct EntityStore {
+  std::vector<float> x, y;        // tiles/blocks: (col, row); agents: position in the left border's frame
+  std::vector<int16_t> cell;      // row * 10 + col, -1 when between or off cells
+  std::vector<uint8_t> state;     // EntityState bits
+  std::vector<MeshHandle> render; // mesh the entity is drawn with
+  uint32_t first[NUM_ENTITY_KINDS], count[NUM_ENTITY_KINDS];
+
+  // Kinds must be added in EntityKind order to stay contiguous
+  uint32_t add (int kind, float ex, float ey, int ecell, uint8_t estate, MeshHandle mesh)
+  {
+    uint32_t id = (uint32_t) x.size();
+    if (!count[kind])
+      first[kind] = id;
+    count[kind]++;
+    x.push_back(ex);
+    y.push_back(ey);
+    cell.push_back((int16_t) ecell);
+    state.push_back(estate);
+    render.push_back(mesh);
+    return id;
+  }
+
+  uint32_t end (int kind) const { return first[kind] + count[kind]; }
+} entities;
+
+const float AGENT_START_X = .5, AGENT_START_Y = 4.5;
+
+void createEntities (MeshHandle tile_mesh, MeshHandle block_mesh, MeshHandle agent_mesh)
+{
+  for (int c = 0; c < 100; c++)
+    entities.add(ENTITY_TILE, c % 10, c / 10, c, 0, tile_mesh);
+  for (int c = 0; c < 100; c++)
+    entities.add(ENTITY_BLOCK, c % 10, c / 10, c, 0, block_mesh);
+  entities.add(ENTITY_AGENT, AGENT_START_X, AGENT_START_Y, -1, ENTITY_AT_START, agent_mesh);
+}
+
+/* Board system: a cell's tile and block exist where the board has it */
+void loadBoardEntities (const uint64_t board[2])
+{
+  for (uint32_t e = entities.first[ENTITY_TILE]; e < entities.end(ENTITY_BLOCK); e++) {
+    int c = entities.cell[e];
+    entities.state[e] = (entities.state[e] & ~ENTITY_PRESENT) | (boardCell(board[0], board[1], c / 10, c % 10) ? ENTITY_PRESENT : 0);
+  }
+}
+
+/* Flip the spin direction of every entity of one kind */
+void reverseEntities (int kind)
+{
+  for (uint32_t e = entities.first[kind]; e < entities.end(kind); e++)
+    entities.state[e] ^= ENTITY_REVERSED;
+}
+
+/* Movement system: step every agent, which leaves the start position */
+void moveAgents (float dx, float dy)
+{
+  for (uint32_t e = entities.first[ENTITY_AGENT]; e < entities.end(ENTITY_AGENT); e++) {
+    entities.x[e] += dx;
+    entities.y[e] += dy;
+    entities.state[e] &= ~ENTITY_AT_START;
+  }
+}
+
+/* Collision system: judge every agent off the start position against the
+   board, sending it straight back to the start when its game ends; returns
+   the last finished game's outcome. Run after every move, like the
+   playouts judge every step. */
+int collideAgents (const uint64_t board[2])
+{
+  int result = GAME_ONGOING;
+  for (uint32_t e = entities.first[ENTITY_AGENT]; e < entities.end(ENTITY_AGENT); e++) {
+    int hx = (int) lround(2 * entities.x[e]), hy = (int) lround(2 * entities.y[e]);
+    entities.cell[e] = (!(hx & 1) && !(hy & 1) && hx >= 0 && hx < 20 && hy >= 0 && hy < 20) ? (hx / 2) * 10 + hy / 2 : -1;
+    if (entities.state[e] & ENTITY_AT_START)
+      continue;
+    int outcome = judgePosition(hx, hy, board[0], board[1]);
+    if (outcome != GAME_ONGOING) {
+      entities.state[e] |= ENTITY_AT_START;
+      entities.x[e] = AGENT_START_X;
+      entities.y[e] = AGENT_START_Y;
+      entities.cell[e] = -1;
+      result = outcome;
+    }
+  }
+  return result;
+}
 
-  static const GLfloat color_buffer_data [] = {
-    .2,.2,.2, // color 1
-    .2,.2,.2, // color 2
-    .2,.2,.2, // color 3
+/* One entity to draw this tick: its mesh and where it is */
+struct RenderItem {
+  uint8_t kind;    // EntityKind
+  uint8_t state;   // EntityState bits
+  int16_t cell;
+  float x, y;
+  MeshHandle mesh;
+};
+
+/* Render list system: present tiles and blocks, then every agent. The list
+   only grows when the store outgrows it, so steady ticks do not allocate. */
+int buildRenderList (std::vector<RenderItem> &items)
+{
+  if (items.size() < entities.end(ENTITY_AGENT))
+    items.resize(entities.end(ENTITY_AGENT));
+  int n = 0;
+  for (uint32_t e = entities.first[ENTITY_TILE]; e < entities.end(ENTITY_AGENT); e++) {
+    if (e < entities.first[ENTITY_AGENT] && !(entities.state[e] & ENTITY_PRESENT))
+      continue;
+    RenderItem item = { (uint8_t) (e < entities.first[ENTITY_BLOCK] ? ENTITY_TILE : e < entities.first[ENTITY_AGENT] ? ENTITY_BLOCK : ENTITY_AGENT),
+                        entities.state[e], entities.cell[e], entities.x[e], entities.y[e], entities.render[e] };
+    items[n++] = item;
+  }
+  return n;
+}
+
+/* Game time advances in fixed ticks of SIM_DT seconds, independent of the
+   frame rate. Frames longer than MAX_FRAME_TIME are clamped so a stall does
+   not make the simulation spiral trying to catch up. */
+const double SIM_DT = 1.0 / 60.0;
+const double MAX_FRAME_TIME = 0.25;
+
+/* Everything draw() needs from one simulation tick. The simulation fills
+   one of these at the end of every tick and never touches it again. */
+struct GameSnapshot {
+  std::vector<RenderItem> render_list; // the first render_count are this tick's
+  int render_count;
+  bool change;
+  int vibration, prev_vibration;
+  double tick_time; // glfwGetTime() at which this tick became current
+};
+
+/* Single-producer single-consumer triple buffer. The writer always has a
+   private slot to fill, the reader always has a private slot to read, and
+   the third slot is swapped between them with one atomic exchange, so
+   neither side ever waits for the other. */
+template <class T>
+class TripleBuffer {
+  static const unsigned FRESH = 4;
+  T slots[3];
+  std::atomic<unsigned> middle;
+  unsigned write_index, read_index;
+public:
+  TripleBuffer() : slots(), middle(2), write_index(0), read_index(1) {}
+
+  T& writeSlot () { return slots[write_index]; }
+
+  // Hand the filled write slot over to the reader
+  void publish ()
+  {
+    unsigned prev = middle.exchange(write_index | FRESH, std::memory_order_acq_rel);
+    write_index = prev & ~FRESH;
+  }
+
+  // Pick up the latest published slot if there is one; returns false if
+  // nothing new was published since the last call
+  bool update ()
+  {
+    if (!(middle.load(std::memory_order_acquire) & FRESH))
+      return false;
+    unsigned prev = middle.exchange(read_index, std::memory_order_acq_rel);
+    read_index = prev & ~FRESH;
+    return true;
+  }
+
+  const T& readSlot () const { return slots[read_index]; }
+};
+
+TripleBuffer<GameSnapshot> snapshots;
+
+/* Apply one input event to the game state; runs inside tick() */
+void applyInput (const InputEvent &event)
+{
+  if (event.type == INPUT_MOUSE_BUTTON) {
+    if (event.code == GLFW_MOUSE_BUTTON_LEFT)
+      reverseEntities(ENTITY_TILE);
+    else if (event.code == GLFW_MOUSE_BUTTON_RIGHT)
+      reverseEntities(ENTITY_BLOCK);
+    return;
+  }
+
+  switch (event.code) {
+    case GLFW_KEY_RIGHT:
+    moveAgents(.5, 0);
+    break;
+    case GLFW_KEY_LEFT:
+    moveAgents(-.5, 0);
+    break;
+    case GLFW_KEY_UP:
+    moveAgents(0, -.5);
+    break;
+    case GLFW_KEY_DOWN:
+    moveAgents(0, .5);
+    break;
+    case GLFW_KEY_C:
+    change = !change;
+    break;
+    default:
+    break;
+  }
+}
+
+void publishSnapshot (double tick_time)
+{
+  GameSnapshot &snap = snapshots.writeSlot();
+  snap.render_count = buildRenderList(snap.render_list);
+  snap.change = change;
+  snap.vibration = vibration;
+  snap.prev_vibration = prev_vibration;
+  snap.tick_time = tick_time;
+  snapshots.publish();
+}
 
-    .2,.2,.2, // color 1
-    .2,.2,.2, // color 2
-    .2,.2,.2, // color 3
+/* Put up a new board when one is due */
+void loadPendingBoard ()
+{
+  if(flag)
+  {
+    if (level_pack.board_count)
+    {
+      memcpy(board_bits, level_pack.boards + 2 * (level_index % level_pack.board_count), sizeof(board_bits));
+      printf("Level %u\n", level_index % level_pack.board_count + 1);
+      level_index++;
+    }
+    else
+      generateBoard(board_bits, 1, rand);
+    loadBoardEntities(board_bits);
+    flag = false;
+  }
+}
+
+/* Judge the current positions and announce a finished game */
+void judgeMove ()
+{
+  int outcome = collideAgents(board_bits);
+  if(outcome == GAME_WIN)
+  {
+    std::cout << "You Win" << '\n';
+    // With a level pack, winning moves on to the next board
+    if (level_pack.board_count) {
+      flag = true;
+      loadPendingBoard();
+    }
+  }
+  else if(outcome == GAME_LOSE)
+  {
+    std::cout << "You lose" << '\n';
+  }
+}
 
-    .2,.2,.2, // color 1
-    .2,.2,.2, // color 2
-    .2,.2,.2, // color 3
+/* Advance the game by one fixed step: input, board generation, animation
+   counters and the win/lose rules. Every move is judged as it is applied,
+   exactly like a playout step, so several key presses in one tick cannot
+   step over a hole. Nothing in here touches GL. */
+void tick ()
+{
+  MemoryScope memory_scope(MEM_BOARD);
+  prev_vibration = vibration;
+  loadPendingBoard();
+
+  InputEvent event;
+  double now = glfwGetTime();
+  while (input_events.pop(event)) {
+    double latency = now - event.time;
+    input_latency.count++;
+    input_latency.total += latency;
+    input_latency.worst = std::max(input_latency.worst, latency);
+    applyInput(event);
+    judgeMove();
+  }
 
-    .2,.2,.2, // color 1
-    .2,.2,.2, // color 2
-    .2,.2,.2, // color 3
+  // Increment angles
+  vibration++;
+  camera_rotation_angle++;
+}
 
-    .2,.2,.2, // color 1
-    .2,.2,.2, // color 2
-    .2,.2,.2, // color 3
+std::thread sim_thread;
+std::atomic<bool> sim_running(false);
 
-    .2,.2,.2, // color 1
-    .2,.2,.2, // color 2
-    .2,.2,.2, // color 3
+/* Simulation thread: runs tick() at SIM_DT intervals and publishes a
+   snapshot after each one, independently of the render loop */
+void simulationLoop ()
+{
+  double next_tick = glfwGetTime();
+  while (sim_running.load(std::memory_order_acquire)) {
+    double now = glfwGetTime();
+    if (now - next_tick > MAX_FRAME_TIME)
+      next_tick = now - MAX_FRAME_TIME;
+    while (next_tick <= now) {
+      tick();
+      publishSnapshot(next_tick);
+      next_tick += SIM_DT;
+    }
+    std::this_thread::sleep_for(std::chrono::duration<double>(next_tick - glfwGetTime()));
+  }
+}
 
-    .2,.2,.2, // color 1
-    .2,.2,.2, // color 2
-    .2,.2,.2, // color 3
+void reportInputLatency ()
+{
+  if (!input_latency.count)
+    return;
+  printf("Input latency: %lu events, mean %.3f ms, worst %.3f ms, %lu dropped\n",
+         input_latency.count, 1000 * input_latency.total / input_latency.count,
+         1000 * input_latency.worst, dropped_input_events);
+}
 
-    .2,.2,.2, // color 1
-    .2,.2,.2, // color 2
-    .2,.2,.2, // color 3
+void startSimulation ()
+{
+  sim_running.store(true, std::memory_order_release);
+  sim_thread = std::thread(simulationLoop);
+}
 
-    .2,.2,.2, // color 1
-    .2,.2,.2, // color 2
-    .2,.2,.2, // color 3
+void stopSimulation ()
+{
+  sim_running.store(false, std::memory_order_release);
+  if (sim_thread.joinable())
+    sim_thread.join();
+}
 
-    .2,.2,.2, // color 1
-    .2,.2,.2, // color 2
-    .2,.2,.2, // color 3
+/* Render the scene with openGL from the latest simulation snapshot */
+/* alpha in [0,1] is how far the current frame lies between the snapshot's
+   previous and latest tick, used to interpolate animated values */
+/* The board lives on the GPU as a 10x10 R8UI texture of presence flags.
+   Tiles and cubes are each one instanced draw of 100 cells; Board.vert
+   places the instance and collapses cells whose flag is 0. A new board
+   costs one 100 byte upload. */
+GpuHandle board_program, board_texture;
+GLint board_sampler_id, board_base_z_id, board_step_z_id;
+bool board_uploaded[10][10];
+bool board_texture_valid = false;
+
+void createBoardTexture ()
+{
+  board_texture = gpuCreate(GPU_TEXTURE);
+  glBindTexture(GL_TEXTURE_2D, gpuName(board_texture));
+  // Integer textures are only complete with NEAREST filtering
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_R8UI, 10, 10, 0, GL_RED_INTEGER, GL_UNSIGNED_BYTE, NULL);
+  gpuSetBytes(board_texture, 10 * 10);
+}
 
-    .2,.2,.2, // color 1
-    .2,.2,.2, // color 2
-    .2,.2,.2, // color 3
+/* Vertex pulling: tiles, cubes and borders are built by Pulled.vert from
+   gl_VertexID with no vertex buffers. Each instance is a center and half
+   size in a texture buffer, holding only the cells that exist. The list
+   changes with the board, not with the vibration, which is the stepZ
+   uniform. A level pack brings its own meshes and so disables this path,
+   as does --no-vertex-pulling. */
+bool vertex_pulling = true;
+
+struct PulledInstance {
+  GLfloat center[3], z_steps; // center.z moves by z_steps * stepZ
+  GLfloat half_size[3], unused;
+};
 
-    .2,.2,.2, // color 1
-    .2,.2,.2, // color 2
-    .2,.2,.2, // color 3
-  };
+const int PULLED_BORDERS = 0, PULLED_TILES = 4; // first instance of each group
+const int MAX_PULLED_INSTANCES = PULLED_TILES + 2 * 100;
 
-  border = create3DObject(GL_TRIANGLES, 36, vertex_buffer_data, color_buffer_data, GL_FILL);
-}
+GpuHandle pull_program, pull_vao, pull_buffer, pull_texture;
+GLint pull_sampler_id, pull_first_id, pull_box_id, pull_step_z_id, pull_palette_id;
+int pulled_cells; // cells on the current board; the cubes follow the tiles
 
-void createCircle()
+/* The four borders as boxes: createBorder's bar moved by border_models,
+   so both paths place them from BORDER_PLACEMENTS. The quarter turns keep
+   the boxes axis aligned. */
+void pulledBorderInstances (PulledInstance instances[4])
 {
-  GLfloat  PI = 3.141592654;
-  GLfloat angle = 0.0;
-  int points = 100;
-  static GLfloat vertex_buffer_data[300];
-  static GLfloat color_buffer_data[300];
-  /* code for circle*/
-  for(int i = 0; i < 3*points;){
-    angle = PI * i / points;
-    vertex_buffer_data[i++] = .2*(float)cos(angle);
-    vertex_buffer_data[i++] = .2*(float)sin(angle);
-    vertex_buffer_data[i++] = .2;
-  }
-  /* code for circle*/
-  for(int i = 0 ; i < 3*points ; ){
-    color_buffer_data[i++] = .78;
-    color_buffer_data[i++] = .2323;
-    color_buffer_data[i++] = .321;
+  for (int i = 0; i < 4; i++) {
+    const glm::mat4 &model = border_models[i];
+    PulledInstance &box = instances[i];
+    memset(&box, 0, sizeof(box));
+    for (int axis = 0; axis < 3; axis++) {
+      box.center[axis] = model[3][axis];
+      for (int k = 0; k < 3; k++)
+        box.half_size[axis] += std::fabs(model[k][axis]) * BORDER_HALF_EXTENTS[k];
+    }
   }
-  circle = create3DObject(GL_TRIANGLE_FAN, points, vertex_buffer_data, color_buffer_data, GL_FILL);
 }
 
-void createLine()
+void createPulledGeometry ()
 {
-  static const GLfloat vertex_buffer_data [] = {
-    // first face
-    -0.5, -0.5, -1.5,
-    -0.5,  0.5, -1.5,
-    0.5,  0.5, -1.5,
-    0.5,  0.5, -1.5,
-    0.5,  -0.5, -1.5,
-    -0.5, -0.5, -1.5,
+  // Core profile draws need a bound VAO, even one without attributes
+  pull_vao = gpuCreate(GPU_VERTEX_ARRAY);
+  pull_buffer = gpuCreate(GPU_BUFFER);
+  gpuBufferData(pull_buffer, GL_TEXTURE_BUFFER, MAX_PULLED_INSTANCES * sizeof(PulledInstance), NULL, GL_DYNAMIC_DRAW);
+  PulledInstance borders[4];
+  pulledBorderInstances(borders);
+  glBufferSubData(GL_TEXTURE_BUFFER, PULLED_BORDERS * sizeof(PulledInstance), sizeof(borders), borders);
+  pull_texture = gpuCreate(GPU_TEXTURE); // storage is counted on pull_buffer
+  glBindTexture(GL_TEXTURE_BUFFER, gpuName(pull_texture));
+  glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, gpuName(pull_buffer));
+}
 
-    // second face
-    0.5, -0.5, 1.5,
-    0.5,  0.5, 1.5,
-    -0.5,  0.5, 1.5,
-    -0.5,  0.5, 1.5,
-    -0.5, -0.5, 1.5,
-    0.5, -0.5, 1.5,
-
-    // third face
-    0.5, -0.5, -1.5,
-    0.5,  0.5, -1.5,
-    0.5,  0.5,  1.5,
-    0.5,  0.5,  1.5,
-    0.5, -0.5,  1.5,
-    0.5, -0.5, -1.5,
-
-    // fourth face
-    -0.5, -0.5,  1.5,
-    -0.5,  0.5,  1.5,
-    -0.5,  0.5, -1.5,
-    -0.5,  0.5, -1.5,
-    -0.5, -0.5, -1.5,
-    -0.5, -0.5,  1.5,
+/* One tile and one cube instance per cell of the board */
+void uploadPulledBoard (const bool v[10][10])
+{
+  int n = 0;
+  for (int row = 0; row < 10; row++)
+    for (int col = 0; col < 10; col++)
+      if (v[row][col])
+        n++;
+  PulledInstance *cells = frame_arena.allocate<PulledInstance>(2 * n);
+  int tile = 0, cube = n;
+  for (int row = 0; row < 10; row++)
+    for (int col = 0; col < 10; col++)
+      if (v[row][col]) {
+        PulledInstance t = { {(GLfloat) col - 4, (GLfloat) row - 5, 0}, 0, {.5, .5, 0}, 0 };
+        PulledInstance c = { {(GLfloat) col - 4, (GLfloat) row - 5, .5}, (GLfloat) (row * 10 + col + 1), {.45, .45, .45}, 0 };
+        cells[tile++] = t;
+        cells[cube++] = c;
+      }
+  pulled_cells = n;
+  glBindBuffer(GL_TEXTURE_BUFFER, gpuName(pull_buffer));
+  glBufferSubData(GL_TEXTURE_BUFFER, PULLED_TILES * sizeof(PulledInstance), 2 * n * sizeof(PulledInstance), cells);
+}
 
-    // fifth face
-    0.5,  0.5,  1.5,
-    0.5,  0.5, -1.5,
-    -0.5,  0.5, -1.5,
-    -0.5,  0.5, -1.5,
-    -0.5,  0.5,  1.5,
-    0.5,  0.5,  1.5,
-
-    // sixth face
-    0.5, -0.5, -1.5,
-    0.5, -0.5,  1.5,
-    -0.5, -0.5,  1.5,
-    -0.5, -0.5,  1.5,
-    -0.5, -0.5, -1.5,
-    0.5, -0.5, -1.5,
-  };
+void bindPulledProgram (GLuint program)
+{
+  bindCameraBlock(program);
+  pull_sampler_id = glGetUniformLocation(program, "instances");
+  pull_first_id = glGetUniformLocation(program, "firstInstance");
+  pull_box_id = glGetUniformLocation(program, "box");
+  pull_step_z_id = glGetUniformLocation(program, "stepZ");
+  pull_palette_id = glGetUniformLocation(program, "palette");
+}
 
-  static const GLfloat color_buffer_data [] = {
-    .78, .2323, .321,
-    .78, .2323, .321,
-    .78, .2323, .321,
+/* Draw count pulled instances from first; palette holds 6 RGB colors */
+void drawPulled (int first, int count, bool box, float step_z, const GLfloat *palette)
+{
+  if (!count)
+    return;
+  glUniform1i(pull_first_id, first);
+  glUniform1i(pull_box_id, box);
+  glUniform1f(pull_step_z_id, step_z);
+  glUniform3fv(pull_palette_id, 6, palette);
+  glDrawArraysInstanced(GL_TRIANGLES, 0, box ? 36 : 6, count);
+}
 
-    .78, .2323, .321,
-    .78, .2323, .321,
-    .78, .2323, .321,
+/* Push the board to whichever path draws it, only when it differs from the
+   last upload */
+void uploadBoard (const bool v[10][10])
+{
+  MemoryScope memory_scope(MEM_BOARD);
+  if (board_texture_valid && !memcmp(board_uploaded, v, sizeof(board_uploaded)))
+    return;
+  memcpy(board_uploaded, v, sizeof(board_uploaded));
+  board_texture_valid = true;
+  if (vertex_pulling) {
+    uploadPulledBoard(v);
+    return;
+  }
+  GLubyte *texels = frame_arena.allocate<GLubyte>(10 * 10);
+  for (int row = 0; row < 10; row++)
+    for (int col = 0; col < 10; col++)
+      texels[row * 10 + col] = v[row][col];
+  glBindTexture(GL_TEXTURE_2D, gpuName(board_texture));
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1); // rows are 10 bytes
+  glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 10, 10, GL_RED_INTEGER, GL_UNSIGNED_BYTE, texels);
+}
 
-    .78, .2323, .321,
-    .78, .2323, .321,
-    .78, .2323, .321,
+void bindBoardProgram (GLuint program)
+{
+  bindCameraBlock(program);
+  board_sampler_id = glGetUniformLocation(program, "board");
+  board_base_z_id = glGetUniformLocation(program, "baseZ");
+  board_step_z_id = glGetUniformLocation(program, "stepZ");
+}
 
-    .78, .2323, .321,
-    .78, .2323, .321,
-    .78, .2323, .321,
+/* Draw `mesh` once per present cell at (col-4, row-5, base_z + (cell+1)*step_z),
+   placed by the camera block's viewProjection */
+void drawBoardCells (MeshHandle mesh, float base_z, float step_z)
+{
+  glUniform1f(board_base_z_id, base_z);
+  glUniform1f(board_step_z_id, step_z);
+  draw3DObject(mesh, 100);
+}
 
-    .78, .2323, .321,
-    .78, .2323, .321,
-    .78, .2323, .321,
+/* Approximate on-screen size in pixels of `radius` model units at the
+   model origin of MVP */
+float projectedRadius (const glm::mat4 &MVP, float radius)
+{
+  float w = MVP[3][3] + CIRCLE_Z * MVP[2][3];
+  if (w <= 0)
+    return 0; // behind the eye
+  float sx = .5f * viewport_width, sy = .5f * viewport_height;
+  float rx = std::hypot(MVP[0][0] * sx, MVP[0][1] * sy);
+  float ry = std::hypot(MVP[1][0] * sx, MVP[1][1] * sy);
+  return radius * std::max(rx, ry) / w;
+}
 
-    .78, .2323, .321,
-    .78, .2323, .321,
-    .78, .2323, .321,
+/* Draw the player circle at the tessellation its screen size calls for */
+void drawCircle (const glm::mat4 &MVP, MeshHandle full_detail)
+{
+  float radius_px = projectedRadius(MVP, CIRCLE_RADIUS);
+  if (radius_px < DISC_SPRITE_MAX_PX && gpuName(disc_program)) {
+    glUseProgram(gpuName(disc_program));
+    glUniformMatrix4fv(disc_mvp_id, 1, GL_FALSE, &MVP[0][0]);
+    glUniform1f(disc_size_id, std::max(1.0f, 2 * radius_px));
+    draw3DObject(disc_marker);
+    glUseProgram(gpuName(main_program));
+    return;
+  }
+  int lod = 0;
+  while (lod + 1 < NUM_CIRCLE_LODS && radius_px < circle_lods[lod].min_radius_px)
+    lod++;
+  glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
+  draw3DObject(lod ? circle_lods[lod].mesh : full_detail);
+}
 
-    .78, .2323, .321,
-    .78, .2323, .321,
-    .78, .2323, .321,
+/**************************
+ * Scene graph            *
+ **************************/
 
-    .78, .2323, .321,
-    .78, .2323, .321,
-    .78, .2323, .321,
+/* Every placed object is a node in one flat array, parents before their
+   children, so world matrices are rebuilt in a single forward pass that
+   starts at the first node whose local matrix changed and only touches
+   that node's subtree. When nothing moved the pass is skipped. draw()
+   walks the same array and keeps each node's MVP until its world matrix
+   or the camera changes, so static nodes such as the borders cost no
+   matrix work per frame. */
+enum SceneDraw { SCENE_GROUP, SCENE_MESH, SCENE_CIRCLE };
+
+struct SceneGraph {
+  std::vector<int> parent;       // -1 for roots, always below the node's own index
+  std::vector<glm::mat4> local, world;
+  std::vector<uint8_t> dirty;    // local changed since the last update
+  std::vector<uint8_t> changed;  // world rebuilt in the current update
+  std::vector<uint8_t> visible;
+  std::vector<uint8_t> draw;     // SceneDraw
+  std::vector<MeshHandle> mesh;
+  std::vector<glm::mat4> mvp;    // view_projection * world, as of mvp_camera
+  std::vector<uint8_t> mvp_stale; // world rebuilt since mvp was computed
+  size_t first_dirty;
+  uint64_t mvp_camera;           // Camera::version the cached MVPs belong to
+
+  SceneGraph () : first_dirty(SIZE_MAX), mvp_camera(UINT64_MAX) {}
+
+  size_t size () const { return parent.size(); }
+
+  int add (int parent_node, const glm::mat4 &local_matrix, SceneDraw draw_kind = SCENE_GROUP, MeshHandle node_mesh = MeshHandle())
+  {
+    int node = (int) size();
+    if (parent_node >= node) {
+      fprintf(stderr, "Error: scene node %d added before its parent %d\n", node, parent_node);
+      exit(EXIT_FAILURE);
+    }
+    parent.push_back(parent_node);
+    local.push_back(local_matrix);
+    world.push_back(local_matrix);
+    dirty.push_back(1);
+    changed.push_back(0);
+    visible.push_back(1);
+    draw.push_back(draw_kind);
+    mesh.push_back(node_mesh);
+    mvp.push_back(glm::mat4(1.0f));
+    mvp_stale.push_back(1);
+    first_dirty = std::min(first_dirty, (size_t) node);
+    return node;
+  }
 
-    .78, .2323, .321,
-    .78, .2323, .321,
-    .78, .2323, .321,
+  void setLocal (int node, const glm::mat4 &local_matrix)
+  {
+    if (local[node] == local_matrix)
+      return;
+    local[node] = local_matrix;
+    dirty[node] = 1;
+    first_dirty = std::min(first_dirty, (size_t) node);
+  }
 
-    .78, .2323, .321,
-    .78, .2323, .321,
-    .78, .2323, .321,
+  void update ()
+  {
+    if (first_dirty >= size())
+      return;
+    for (size_t i = first_dirty; i < size(); i++) {
+      int p = parent[i];
+      if (!dirty[i] && (p < 0 || !changed[p]))
+        continue;
+      world[i] = p < 0 ? local[i] : world[p] * local[i];
+      dirty[i] = 0;
+      changed[i] = 1;
+      mvp_stale[i] = 1;
+    }
+    std::fill(changed.begin() + first_dirty, changed.end(), 0);
+    first_dirty = SIZE_MAX;
+  }
+} scene;
 
-    .78, .2323, .321,
-    .78, .2323, .321,
-    .78, .2323, .321,
+int scene_root, scene_borders[4], scene_start, scene_player;
 
-    .78, .2323, .321,
-    .78, .2323, .321,
-    .78, .2323, .321,
-  };
-  line = create3DObject(GL_LINES, 2, vertex_buffer_data, color_buffer_data, GL_FILL);
+/* The player, at the start position or in the left border's frame; the
+   borders are drawn by Pulled.vert when vertex pulling is on */
+void buildScene ()
+{
+  scene_root = scene.add(-1, glm::mat4(1.0f));
+  for (int i = 0; i < 4; i++)
+    scene_borders[i] = scene.add(scene_root, border_models[i], vertex_pulling ? SCENE_GROUP : SCENE_MESH, border);
+  // The circles' meshes come from the agent's render item each frame
+  scene_start = scene.add(scene_root, glm::translate(glm::vec3(-4, -5, 1.4)), SCENE_CIRCLE);
+  scene_player = scene.add(scene_borders[LEFT_BORDER], glm::mat4(1.0f), SCENE_CIRCLE);
+  scene.update();
 }
 
-float camera_rotation_angle = 90;
-float rectangle_rotation = 0;
-float triangle_rotation = 0;
-bool flag = true;
-bool v[10][10];
-int vibration=1;
+void drawScene (const Camera &view)
+{
+  // Hidden nodes keep their flag, so a camera change has to reach them too
+  if (scene.mvp_camera != view.version)
+    std::fill(scene.mvp_stale.begin(), scene.mvp_stale.end(), 1);
+  scene.mvp_camera = view.version;
+  for (size_t i = 0; i < scene.size(); i++) {
+    if (scene.draw[i] == SCENE_GROUP || !scene.visible[i])
+      continue;
+    if (scene.mvp_stale[i]) {
+      scene.mvp[i] = view.matrices.view_projection * scene.world[i];
+      scene.mvp_stale[i] = 0;
+    }
+    const glm::mat4 &MVP = scene.mvp[i];
+    if (scene.draw[i] == SCENE_CIRCLE) {
+      drawCircle(MVP, scene.mesh[i]);
+      continue;
+    }
+    glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
+    draw3DObject(scene.mesh[i]);
+  }
+}
 
-/* Render the scene with openGL */
-/* Edit this function according to your assignment */
-void draw ()
+void draw (const GameSnapshot &snap, float alpha)
 {
   // clear the color and depth in the frame buffer
   glClear (GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
   // use the loaded shader program
   // Don't change unless you know what you are doing
-  glUseProgram (programID);
+  glUseProgram (gpuName(main_program));
 
   // Eye - Location of camera. Don't change unless you are sure!!
   vec3 eye;
-  if(change)
+  if(snap.change)
     eye = vec3(0, 0, 5);
   else
     eye = vec3(0, -7, 3);
@@ -716,14 +3082,13 @@ void draw ()
   // Up - Up vector defines tilt of camera.  Don't change unless you are sure!!
   glm::vec3 up (0, 1, 0);
 
-  // Compute Camera matrix (view)
-  Matrices.view = glm::lookAt( eye, target, up ); // Rotating Camera for 3D
-  //  Don't change unless you are sure!!
-  // Matrices.view = glm::lookAt(glm::vec3(0,0,10), glm::vec3(0,0,0), glm::vec3(0,1,0)); // Fixed camera for 2D (ortho) in XY plane
+  // Camera matrix (view); recomputed only when the eye actually moved
+  camera.lookAt( eye, target, up );
 
-  // Compute ViewProject matrix as view/camera might not be changed for this frame (basic scenario)
+  // ViewProject matrix, cached in the camera and shared through its UBO
   //  Don't change unless you are sure!!
-  glm::mat4 VP = Matrices.projection * Matrices.view;
+  camera.upload();
+  glm::mat4 VP = camera.matrices.view_projection;
 
   // Send our transformation to the currently bound shader, in the "MVP" uniform
   // For each model you render, since the MVP will be different (at least the M part)
@@ -737,7 +3102,6 @@ void draw ()
 
   // glm::mat4 translateTriangle = glm::translate (glm::vec3(-2.0f, 0.0f, 0.0f)); // glTranslatef
   // glm::mat4 rotateTriangle = glm::rotate((float)(triangle_rotation*M_PI/180.0f), glm::vec3(0,0,1));  // rotate about vector (1,0,0)
-  camera_rotation_angle++;
   // glm::mat4 triangleTransform = translateTriangle * rotateTriangle;
   // Matrices.model *= triangleTransform; 
   MVP = VP * Matrices.model; // MVP = p * V * M
@@ -747,135 +3111,718 @@ void draw ()
 
   // draw3DObject draws the VAO given to it using current MVP matrix
   // float i = 0, j = 0;
-  if(flag)
+  float vib = snap.prev_vibration + (snap.vibration - snap.prev_vibration) * alpha;
+
+  // Tiles, then the cubes on top of them, which step up along the board as it vibrates
+  // Tiles and blocks share the board's cells; their meshes come with the items
+  bool cells[10][10];
+  memset(cells, 0, sizeof(cells));
+  MeshHandle tile_mesh, block_mesh;
+  const RenderItem *agent = NULL;
+  for (int i = 0; i < snap.render_count; i++) {
+    const RenderItem &item = snap.render_list[i];
+    if (item.kind == ENTITY_TILE)
+      tile_mesh = item.mesh;
+    else if (item.kind == ENTITY_BLOCK) {
+      block_mesh = item.mesh;
+      if (item.cell >= 0 && item.cell < 100)
+        cells[item.cell / 10][item.cell % 10] = true;
+    }
+    else if (!agent)
+      agent = &item;
+  }
+  uploadBoard(cells);
+  float step_z = .004 * std::sin(vib*M_PI/180);
+  if (vertex_pulling)
+  {
+    glUseProgram(gpuName(pull_program));
+    bindVertexArray(gpuName(pull_vao));
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_BUFFER, gpuName(pull_texture));
+    glUniform1i(pull_sampler_id, 0);
+    drawPulled(PULLED_TILES, pulled_cells, false, 0, square_colors);
+    drawPulled(PULLED_TILES + pulled_cells, pulled_cells, true, step_z, CUBOID_FACE_COLORS[0]);
+    drawPulled(PULLED_BORDERS, 4, true, 0, BORDER_FACE_COLORS[0]);
+    glUseProgram(gpuName(main_program));
+  }
+  else
+  {
+    glUseProgram(gpuName(board_program));
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, gpuName(board_texture));
+    glUniform1i(board_sampler_id, 0);
+    if (tile_mesh)
+      drawBoardCells(tile_mesh, 0, 0);
+    if (block_mesh)
+      drawBoardCells(block_mesh, .5, step_z);
+    glUseProgram(gpuName(main_program));
+  }
+
+  // Borders and the player, from the scene graph; only the player moves
+  bool at_start = agent && (agent->state & ENTITY_AT_START);
+  scene.visible[scene_start] = at_start;
+  scene.visible[scene_player] = agent && !at_start;
+  if (agent) {
+    scene.mesh[scene_start] = scene.mesh[scene_player] = agent->mesh;
+    if (at_start)
+      scene.setLocal(scene_start, translate(vec3(-4,-5,1.4 + step_z)));
+    else
+      scene.setLocal(scene_player, translate(vec3(agent->x,1.4,agent->y + step_z)));
+  }
+  scene.update();
+  drawScene(camera);
+
+  //camera_rotation_angle++; // Simulating camera rotation
+  // triangle_rotation = triangle_rotation + increments*triangle_rot_dir*triangle_rot_status;
+  // rectangle_rotation = rectangle_rotation + increments*rectangle_rot_dir*rectangle_rot_status;
+}
+
+/**************************
+ * Job system             *
+ **************************/
+
+/* Work-stealing pool. Every worker owns a deque: it pushes and pops its
+   own jobs at the back, newest first while their data is still in cache,
+   and idle workers steal the oldest jobs from the front of the others'.
+   Threads outside the pool (main, simulation) share deque 0. A job counts
+   itself plus its unfinished children, so waiting on a parent waits for
+   the whole tree, and a waiting thread runs queued jobs instead of
+   blocking. Jobs come from a per-deque ring and carry their closure
+   inline, so submitting one never allocates. create() skips ring slots
+   whose jobs are unfinished and, with the whole ring in use, runs queued
+   jobs until one frees or fails when there are none; run() executes the
+   job inline when its deque is full. */
+const int JOB_DATA_BYTES = 40;
+const unsigned JOB_RING_SIZE = 4096;
+
+struct Job {
+  void (*function) (void *data);
+  Job *parent;
+  std::atomic<int> unfinished {0};
+  MemoryTag tag; // the creator's, so the job's allocations are charged alike
+  alignas(8) unsigned char data[JOB_DATA_BYTES];
+};
+
+thread_local unsigned job_worker = 0;
+
+class JobSystem {
+  struct Worker {
+    std::mutex lock;
+    Job *queue[JOB_RING_SIZE];
+    unsigned front, back;             // queue[front % N] .. queue[(back - 1) % N]
+    std::unique_ptr<Job[]> ring;
+    std::atomic<unsigned> next_job;
+    Worker () : front(0), back(0), ring(new Job[JOB_RING_SIZE]), next_job(0) {}
+  };
+
+  std::vector<std::unique_ptr<Worker>> workers;
+  std::vector<std::thread> threads;
+  std::atomic<bool> running;
+  std::atomic<int> queued;
+  std::mutex sleep_lock;
+  std::condition_variable wake;
+
+  Job *pop (Worker &w, bool newest)
+  {
+    std::lock_guard<std::mutex> guard(w.lock);
+    if (w.front == w.back)
+      return NULL;
+    queued.fetch_sub(1, std::memory_order_relaxed);
+    return newest ? w.queue[--w.back % JOB_RING_SIZE] : w.queue[w.front++ % JOB_RING_SIZE];
+  }
+
+  // Own deque first, then steal starting from the next worker along
+  bool runOne ()
+  {
+    unsigned n = workers.size();
+    Job *job = pop(*workers[job_worker], true);
+    for (unsigned i = 1; !job && i < n; i++)
+      job = pop(*workers[(job_worker + i) % n], false);
+    if (!job)
+      return false;
+    execute(job);
+    return true;
+  }
+
+  void execute (Job *job)
   {
-    for(int i = 0 ; i < 10 ; i++)
     {
-      for(int j = 0 ; j < 10 ; j++)
-        v[i][j] = true;
+      MemoryScope memory_scope(job->tag);
+      job->function(job->data);
     }
+    finish(job);
+  }
 
-    for(int i = 0 ; i < 10 ; i++)
-    {
-      int a=rand()%10;
-      if(!(a == i && (a != 9 || a != 0)))
-        v[i][a] = false;
+  // Read parent first: once unfinished reaches 0, create() may reuse the slot
+  void finish (Job *job)
+  {
+    while (job) {
+      Job *parent = job->parent;
+      if (job->unfinished.fetch_sub(1, std::memory_order_acq_rel) != 1)
+        break;
+      job = parent;
     }
-    flag = false;
   }
-  MVP *= translate(vec3(-5.0,-5.0,0.0f));
-  for(int row = 0 ; row < 10 ; row++)
+
+  void workerLoop (unsigned index)
   {
-    for(int col = 0 ; col < 10 ; col++)
-    {
-      glm::mat4 translateTriangle = glm::translate (glm::vec3(1, 0, 0.0f)); // glTranslatef
-      MVP *= translateTriangle;
-      glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-      if(v[row][col])
-        draw3DObject(triangle);
+    job_worker = index;
+    int idle = 0;
+    while (running.load(std::memory_order_acquire)) {
+      if (runOne()) {
+        idle = 0;
+        continue;
+      }
+      if (++idle < 64) {
+        std::this_thread::yield();
+        continue;
+      }
+      std::unique_lock<std::mutex> sleeping(sleep_lock);
+      wake.wait_for(sleeping, std::chrono::milliseconds(1), [this] {
+        return queued.load(std::memory_order_relaxed) > 0 || !running.load(std::memory_order_relaxed);
+      });
     }
-    glm::mat4 translateTriangle = glm::translate (glm::vec3(-10, 1, 0.0f)); // glTranslatef
-    MVP *= translateTriangle;
   }
 
-  MVP = VP * Matrices.model; // MVP = p * V * M
-  MVP *= translate(vec3(-5.0,-5.0,0.5f));
-  for(int i = 0 ; i < 10 ; i++)
+public:
+  JobSystem () : running(false), queued(0) {}
+  ~JobSystem () { stop(); } // exit() inside a parallel section must not leave joinable threads
+
+  // thread_count workers besides the threads that call wait()
+  void start (unsigned thread_count)
+  {
+    stop();
+    workers.clear();
+    for (unsigned i = 0; i <= thread_count; i++)
+      workers.push_back(std::unique_ptr<Worker>(new Worker));
+    running = true;
+    for (unsigned i = 1; i <= thread_count; i++)
+      threads.push_back(std::thread(&JobSystem::workerLoop, this, i));
+  }
+
+  void stop ()
+  {
+    running = false;
+    wake.notify_all();
+    // A worker calling exit() ends up here through ~JobSystem(); it cannot
+    // join itself, so it is left to the process teardown
+    for (size_t i = 0; i < threads.size(); i++)
+      if (threads[i].get_id() == std::this_thread::get_id())
+        threads[i].detach();
+      else
+        threads[i].join();
+    threads.clear();
+  }
+
+  /* A job calling fn(), finished only once its children are. fn is copied
+     into the job, so it must be small and trivially copyable (capture
+     pointers or references to anything bigger). */
+  template <class F>
+  Job *create (const F &fn, Job *parent = NULL)
+  {
+    static_assert(sizeof(F) <= JOB_DATA_BYTES && std::is_trivially_copyable<F>::value, "job closure too big");
+    Worker &w = *workers[job_worker];
+    Job *job = NULL;
+    while (!job) {
+      // Skip slots still in use: they may belong to a job that is waiting
+      // on the one being created
+      for (unsigned i = 0; i < JOB_RING_SIZE && !job; i++) {
+        Job *slot = &w.ring[w.next_job.fetch_add(1, std::memory_order_relaxed) % JOB_RING_SIZE];
+        if (slot->unfinished.load(std::memory_order_acquire) == 0)
+          job = slot;
+      }
+      if (!job && !runOne()) {
+        fprintf(stderr, "Error: more than %u unfinished jobs created on one thread\n", JOB_RING_SIZE);
+        exit(EXIT_FAILURE);
+      }
+    }
+    job->function = [] (void *data) { (*(F *) data)(); };
+    job->parent = parent;
+    job->unfinished.store(1, std::memory_order_relaxed);
+    job->tag = memory_tag;
+    memcpy(job->data, &fn, sizeof(F));
+    if (parent)
+      parent->unfinished.fetch_add(1, std::memory_order_relaxed);
+    return job;
+  }
+
+  void run (Job *job)
   {
-    mat4 translateRectangle;
-    for(int j = 0 ; j < 10 ; j++)
+    Worker &w = *workers[job_worker];
+    bool full;
     {
-      translateRectangle = glm::translate (glm::vec3(1, 0, .004 * std::sin(vibration*M_PI/180)));        // glTranslatef
-      MVP *= translateRectangle;
-      glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-      if(v[i][j])
-        draw3DObject(rectangle);
+      std::lock_guard<std::mutex> guard(w.lock);
+      full = w.back - w.front == JOB_RING_SIZE;
+      if (!full)
+        w.queue[w.back++ % JOB_RING_SIZE] = job;
     }
-    translateRectangle = glm::translate (glm::vec3(-10, 1, 0.0f)); // glTranslatef
-    MVP *= translateRectangle;
+    if (full) {
+      execute(job);
+      return;
+    }
+    queued.fetch_add(1, std::memory_order_relaxed);
+    wake.notify_one();
   }
 
-  MVP = VP * Matrices.model;
-  mat4 rotateBorder = rotate((float)(90.0f*M_PI/180.0f), vec3(0,1,0));
-  mat4 translateBorder = translate(vec3(0,5,0));
-  MVP *= rotateBorder*translateBorder;
-  glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-  draw3DObject(border);
+  void wait (const Job *job)
+  {
+    while (job->unfinished.load(std::memory_order_acquire) > 0)
+      if (!runOne())
+        std::this_thread::yield();
+  }
 
-  MVP = VP * Matrices.model;
-  rotateBorder = rotate((float)(90.0f*M_PI/180.0f), vec3(0,1,0));
-  translateBorder = translate(vec3(0,-6,0.5));
-  MVP *= rotateBorder*translateBorder;
-  glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-  draw3DObject(border);
+  unsigned size () const { return workers.size(); }
 
-  MVP = VP * Matrices.model;
-  rotateBorder = rotate((float)(90.0f*M_PI/180.0f), vec3(1,0,0));
-  translateBorder = translate(vec3(6,0,0));
-  MVP *= rotateBorder*translateBorder;
-  glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-  draw3DObject(border);
+  /* fn(begin, end) over [0, count) in chunks of at least `chunk`, as the
+     children of one parent job; returns once all of them ran */
+  template <class F>
+  void parallelFor (size_t count, size_t chunk, const F &fn)
+  {
+    chunk = std::max(chunk, std::max<size_t>(1, count / (JOB_RING_SIZE / 2)));
+    const F *body = &fn;
+    Job *root = create([] {});
+    for (size_t begin = 0; begin < count; begin += chunk) {
+      size_t end = std::min(count, begin + chunk);
+      run(create([body, begin, end] { (*body)(begin, end); }, root));
+    }
+    run(root);
+    wait(root);
+  }
+} jobs;
 
-  MVP = VP * Matrices.model;
-  rotateBorder = rotate((float)(90.0f*M_PI/180.0f), vec3(1,0,0));
-  translateBorder = translate(vec3(-5,0,0));
-  MVP *= rotateBorder*translateBorder;
-  glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-  draw3DObject(border);
+/**************************
+ * Headless playouts      *
+ **************************/
 
-  if(initial)
+/* Monte Carlo playouts: millions of games on freshly generated boards,
+   judged by judgePosition() exactly like tick(), with no GLFW or GL
+   involved. Used to tune board difficulty. */
+enum PlayoutPolicy { POLICY_RANDOM, POLICY_BIASED, POLICY_SCRIPT };
+
+struct PlayoutConfig {
+  long games;             // games per generator setting
+  std::vector<int> holes; // generator settings (holes per row) to sweep
+  int policy;
+  std::string script;     // R/L/U/D moves for POLICY_SCRIPT
+  int max_steps;          // games still running after this many moves time out
+  unsigned threads;
+  uint64_t seed;
+};
+
+struct PlayoutStats {
+  long wins, losses, timeouts;
+  unsigned long long steps;
+  std::vector<long> win_length, lose_length; // path length histograms
+
+  void reset (int max_steps)
   {
-    MVP = VP * Matrices.model;
-    translateBorder = translate(vec3(-4,-5,1.4 + .004 * sin(vibration*M_PI/180)));
-    MVP *= translateBorder;
-    x_man = .5; y_men = 4.5;
-    glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-    draw3DObject(circle);
+    wins = losses = timeouts = 0;
+    steps = 0;
+    win_length.assign(max_steps + 1, 0);
+    lose_length.assign(max_steps + 1, 0);
   }
-  else
+
+  void merge (const PlayoutStats &other)
   {
-    if(x_man > 9.5 || x_man < 1 || y_men < -4.5 || y_men > 4.5)
-    {
-      initial = true;
-      if(x_man >= 9 && y_men <= -4)
-      {
-        initial = true;
-        std::cout << "You Win" << '\n';
+    wins += other.wins;
+    losses += other.losses;
+    timeouts += other.timeouts;
+    steps += other.steps;
+    for (size_t i = 0; i < win_length.size(); i++) {
+      win_length[i] += other.win_length[i];
+      lose_length[i] += other.lose_length[i];
+    }
+  }
+};
+
+/* xorshift64* - one independent stream per lane and per worker */
+inline uint32_t xorshiftNext (uint64_t &state)
+{
+  state ^= state >> 12;
+  state ^= state << 25;
+  state ^= state >> 27;
+  return (uint32_t)((state * 0x2545F4914F6CDD1DULL) >> 32);
+}
+
+struct PlayoutRng {
+  uint64_t state;
+  uint32_t operator() () { return xorshiftNext(state); }
+};
+
+inline uint64_t splitmix64 (uint64_t &x)
+{
+  uint64_t z = (x += 0x9E3779B97F4A7C15ULL);
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+  return z ^ (z >> 31);
+}
+
+/* A batch of games stepped together, one lane per game, each field in its
+   own array so the step loop streams through memory */
+struct PlayoutBatch {
+  static const int LANES = 256;
+  int16_t hx[LANES], hy[LANES];
+  int32_t steps[LANES];
+  uint64_t board_lo[LANES], board_hi[LANES];
+  uint64_t rng[LANES];
+  bool active[LANES];
+};
+
+void playoutWorker (const PlayoutConfig &cfg, int holes, long games, uint64_t seed, PlayoutStats &stats)
+{
+  MemoryScope memory_scope(MEM_PLAYOUT);
+  static const int DX[4] = { 1, -1, 0, 0 };  // R L U D, as applyInput()
+  static const int DY[4] = { 0, 0, -1, 1 };
+  std::unique_ptr<PlayoutBatch> batch(new PlayoutBatch);
+  PlayoutBatch &b = *batch;
+  PlayoutRng board_rng = { splitmix64(seed) | 1 };
+  int max_steps = cfg.max_steps;
+  if (cfg.policy == POLICY_SCRIPT)
+    max_steps = std::min(max_steps, (int)cfg.script.size());
+  std::vector<uint8_t> script(cfg.script.size());
+  for (size_t i = 0; i < script.size(); i++)
+    script[i] = (uint8_t)(strchr("RLUD", cfg.script[i]) - "RLUD");
+
+  long started = 0;
+  int live = 0;
+  auto startLane = [&] (int l) {
+    uint64_t board[2];
+    generateBoard(board, holes, board_rng);
+    b.board_lo[l] = board[0];
+    b.board_hi[l] = board[1];
+    b.hx[l] = 1; b.hy[l] = 9; // x_man = .5, y_men = 4.5
+    b.steps[l] = 0;
+    b.rng[l] = splitmix64(seed) | 1;
+    b.active[l] = true;
+    started++;
+    live++;
+  };
+  for (int l = 0; l < PlayoutBatch::LANES; l++) {
+    b.active[l] = false;
+    if (started < games)
+      startLane(l);
+  }
+
+  while (live) {
+    for (int l = 0; l < PlayoutBatch::LANES; l++) {
+      if (!b.active[l])
+        continue;
+
+      int move;
+      if (cfg.policy == POLICY_SCRIPT)
+        move = script[b.steps[l]];
+      else {
+        uint32_t r = xorshiftNext(b.rng[l]);
+        if (cfg.policy == POLICY_RANDOM)
+          move = r >> 30;
+        else // biased: 3/8 right, 3/8 up, 1/8 left, 1/8 down
+          move = "\0\0\0\2\2\2\1\3"[r >> 29];
+      }
+      b.hx[l] += DX[move];
+      b.hy[l] += DY[move];
+      int steps = ++b.steps[l];
+
+      int outcome = judgePosition(b.hx[l], b.hy[l], b.board_lo[l], b.board_hi[l]);
+      if (outcome == GAME_ONGOING && steps < max_steps)
+        continue;
+
+      stats.steps += steps;
+      if (outcome == GAME_WIN) {
+        stats.wins++;
+        stats.win_length[steps]++;
+      }
+      else if (outcome == GAME_LOSE) {
+        stats.losses++;
+        stats.lose_length[steps]++;
       }
       else
-        std::cout << "You lose" << '\n';
+        stats.timeouts++;
+
+      live--;
+      b.active[l] = false;
+      if (started < games)
+        startLane(l);
     }
-    else if(x_man == 9.5 && y_men == -4.5)
-    {
-      initial = true;
-      std::cout << "You Win" << '\n';
+  }
+}
+
+/* Mean and percentiles of a path length histogram */
+void describeLengths (const char *label, const std::vector<long> &hist, long total)
+{
+  if (!total) {
+    printf("  %-5s length: -\n", label);
+    return;
+  }
+  double sum = 0;
+  for (size_t i = 0; i < hist.size(); i++)
+    sum += (double)i * hist[i];
+  const double quantiles[3] = { 0.5, 0.9, 0.99 };
+  int values[3] = { 0, 0, 0 };
+  for (int q = 0; q < 3; q++) {
+    long seen = 0, want = (long)std::ceil(quantiles[q] * total);
+    for (size_t i = 0; i < hist.size(); i++) {
+      seen += hist[i];
+      if (seen >= want) {
+        values[q] = (int)i;
+        break;
+      }
     }
-    for(int i = 0 ; i < 10 ; i++)
-    {
-      for(int j = 0 ; j < 10 ; j++)
-      {
-        if(!v[i][j] && (std::fabs(i-x_man) < .5 && std::fabs(j-y_men) < .5))
-        {
-          initial = true;
-          std::cout << "You lose" << '\n';
+  }
+  printf("  %-5s length: mean %.2f, p50 %d, p90 %d, p99 %d\n",
+         label, sum / total, values[0], values[1], values[2]);
+}
+
+const unsigned PLAYOUT_CHUNKS_PER_THREAD = 4;
+
+int runPlayouts (const PlayoutConfig &cfg)
+{
+  MemoryScope memory_scope(MEM_PLAYOUT);
+  static const char *policy_names[] = { "random", "biased", "script" };
+  unsigned threads = cfg.threads ? cfg.threads : std::max(1u, std::thread::hardware_concurrency());
+  uint64_t seed = cfg.seed;
+  printf("Playouts: %ld games per setting, policy %s, max %d steps, %u threads\n",
+         cfg.games, policy_names[cfg.policy], cfg.max_steps, threads);
+
+  // A few chunks per thread so workers that finish early can steal
+  jobs.start(threads - 1);
+  unsigned chunks = threads * PLAYOUT_CHUNKS_PER_THREAD;
+  for (size_t h = 0; h < cfg.holes.size(); h++) {
+    std::vector<PlayoutStats> per_chunk(chunks);
+    std::vector<uint64_t> seeds(chunks);
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned c = 0; c < chunks; c++) {
+      per_chunk[c].reset(cfg.max_steps);
+      seeds[c] = splitmix64(seed);
+    }
+    int holes = cfg.holes[h];
+    jobs.parallelFor(chunks, 1, [&] (size_t begin, size_t end) {
+      for (size_t c = begin; c < end; c++)
+        playoutWorker(cfg, holes, cfg.games / chunks + ((long) c < cfg.games % chunks ? 1 : 0), seeds[c], per_chunk[c]);
+    });
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    PlayoutStats total = per_chunk[0];
+    for (unsigned c = 1; c < chunks; c++)
+      total.merge(per_chunk[c]);
+    long played = total.wins + total.losses + total.timeouts;
+    printf("holes/row %d: %ld games, win %.4f%%, lose %.4f%%, timeout %.4f%%\n",
+           cfg.holes[h], played, 100.0 * total.wins / std::max(played, 1L),
+           100.0 * total.losses / std::max(played, 1L), 100.0 * total.timeouts / std::max(played, 1L));
+    describeLengths("win", total.win_length, total.wins);
+    describeLengths("lose", total.lose_length, total.losses);
+    printf("  %llu steps in %.3f s, %.1f M steps/s\n", total.steps, seconds, total.steps / seconds / 1e6);
+  }
+  jobs.stop();
+  return EXIT_SUCCESS;
+}
+
+/* Parse the playout options; returns false if --playout was not given */
+bool parsePlayoutArgs (int argc, char **argv, PlayoutConfig &cfg)
+{
+  bool enabled = false;
+  cfg.games = 1000000;
+  cfg.policy = POLICY_RANDOM;
+  cfg.max_steps = 1000;
+  cfg.threads = 0;
+  cfg.seed = 1;
+  for (int i = 1; i < argc; i++) {
+    const char *next = i + 1 < argc ? argv[i + 1] : NULL;
+    if (!strcmp(argv[i], "--playout")) {
+      enabled = true;
+      if (next && isdigit((unsigned char)next[0]))
+        cfg.games = atol(argv[++i]);
+    }
+    else if (!strcmp(argv[i], "--holes") && next) {
+      // comma separated list of holes per row, e.g. 1,2,3
+      for (const char *p = argv[++i]; *p; ) {
+        cfg.holes.push_back(std::max(0, atoi(p)));
+        p = strchr(p, ',');
+        if (!p)
           break;
-        }
+        p++;
       }
-      if(initial)
-        break;
     }
-    translateBorder = translate(vec3(x_man,1.4,y_men + .004 * sin(vibration*M_PI/180)));
-    MVP *= translateBorder;
-    glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-    draw3DObject(circle);
+    else if (!strcmp(argv[i], "--policy") && next) {
+      const char *name = argv[++i];
+      if (!strcmp(name, "random"))
+        cfg.policy = POLICY_RANDOM;
+      else if (!strcmp(name, "biased"))
+        cfg.policy = POLICY_BIASED;
+      else if (!strncmp(name, "script:", 7) && name[7] && strspn(name + 7, "RLUD") == strlen(name + 7)) {
+        cfg.policy = POLICY_SCRIPT;
+        cfg.script = name + 7;
+      }
+      else {
+        fprintf(stderr, "Unknown policy %s (random, biased or script:RLUD...)\n", name);
+        exit(EXIT_FAILURE);
+      }
+    }
+    else if (!strcmp(argv[i], "--max-steps") && next)
+      cfg.max_steps = std::max(1, atoi(argv[++i]));
+    else if (!strcmp(argv[i], "--threads") && next)
+      cfg.threads = (unsigned)std::max(0, atoi(argv[++i]));
+    else if (!strcmp(argv[i], "--seed") && next)
+      cfg.seed = strtoull(argv[++i], NULL, 10);
   }
+  if (cfg.holes.empty())
+    cfg.holes.push_back(1);
+  return enabled;
+}
 
-  // Increment angles
-  float increments = 1;
-  vibration++;
-  //camera_rotation_angle++; // Simulating camera rotation
-  // triangle_rotation = triangle_rotation + increments*triangle_rot_dir*triangle_rot_status;
-  // rectangle_rotation = rectangle_rotation + increments*rectangle_rot_dir*rectangle_rot_status;
+/* --write-pack: store the built-in meshes, de-duplicated and indexed, and
+   board_count freshly generated boards. Needs no GL. */
+const size_t PACK_BOARD_CHUNK = 256;
+
+bool writeLevelPack (const char *path, uint32_t board_count, int holes_per_row, uint64_t seed)
+{
+  MemoryScope memory_scope(MEM_LEVEL_PACK);
+  std::vector<PackMesh> meshes;
+  std::vector<MeshVertex> vertices;
+  std::vector<uint32_t> indices;
+  for (int b = 0; b < NUM_BUILTIN_MESHES; b++) {
+    const BuiltinMesh &src = builtin_meshes[b];
+    PackMesh mesh;
+    memset(&mesh, 0, sizeof(mesh));
+    strncpy(mesh.name, src.name, sizeof(mesh.name) - 1);
+    mesh.primitive = src.primitive;
+    mesh.first_vertex = vertices.size();
+    mesh.first_index = indices.size();
+    for (int v = 0; v < src.num_vertices; v++) {
+      MeshVertex vertex;
+      memcpy(vertex.position, src.vertices + 3 * v, sizeof(vertex.position));
+      memcpy(vertex.color, src.colors + 3 * v, sizeof(vertex.color));
+      uint32_t index = mesh.first_vertex;
+      while (index < vertices.size() && memcmp(&vertices[index], &vertex, sizeof(vertex)))
+        index++;
+      if (index == vertices.size())
+        vertices.push_back(vertex);
+      indices.push_back(index - mesh.first_vertex);
+    }
+    mesh.vertex_count = vertices.size() - mesh.first_vertex;
+    mesh.index_count = indices.size() - mesh.first_index;
+    meshes.push_back(mesh);
+  }
+
+  // Boards are generated in parallel, each run of PACK_BOARD_CHUNK from
+  // its own stream so the pack only depends on the seed
+  std::vector<uint64_t> boards(2 * (size_t) board_count);
+  jobs.start(std::max(1u, std::thread::hardware_concurrency()) - 1);
+  jobs.parallelFor(board_count, PACK_BOARD_CHUNK, [&] (size_t begin, size_t end) {
+    uint64_t stream = seed + begin;
+    PlayoutRng rng = { splitmix64(stream) | 1 };
+    for (size_t b = begin; b < end; b++)
+      generateBoard(&boards[2 * b], holes_per_row, rng);
+  });
+  jobs.stop();
+
+  PackHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, "GLPK", 4);
+  header.version = PACK_VERSION;
+  header.mesh_count = meshes.size();
+  header.board_count = board_count;
+  header.vertex_count = vertices.size();
+  header.index_count = indices.size();
+  header.mesh_offset = packAlign(sizeof(header));
+  header.vertex_offset = packAlign(header.mesh_offset + meshes.size() * sizeof(PackMesh));
+  header.index_offset = packAlign(header.vertex_offset + vertices.size() * sizeof(MeshVertex));
+  header.board_offset = packAlign(header.index_offset + indices.size() * sizeof(uint32_t));
+  header.file_size = header.board_offset + boards.size() * sizeof(uint64_t);
+
+  std::vector<char> file(header.file_size, 0);
+  memcpy(&file[0], &header, sizeof(header));
+  memcpy(&file[header.mesh_offset], meshes.data(), meshes.size() * sizeof(PackMesh));
+  memcpy(&file[header.vertex_offset], vertices.data(), vertices.size() * sizeof(MeshVertex));
+  memcpy(&file[header.index_offset], indices.data(), indices.size() * sizeof(uint32_t));
+  if (board_count)
+    memcpy(&file[header.board_offset], boards.data(), boards.size() * sizeof(uint64_t));
+
+  std::ofstream out(path, std::ios::out | std::ios::binary | std::ios::trunc);
+  out.write(&file[0], file.size());
+  out.close();
+  if (!out) {
+    fprintf(stderr, "Cannot write level pack %s\n", path);
+    return false;
+  }
+  printf("Wrote %s: %zu meshes, %zu vertices, %zu indices, %u boards\n",
+         path, meshes.size(), vertices.size(), indices.size(), board_count);
+  return true;
+}
+
+/* GL loading: gladLoadGLLoader resolves every GL 3.3 entry point and
+   every extension glad knows about, and scans the extension list. The
+   minimal loader resolves only the functions this file calls, listed in
+   gl_used.gen.h, which the Makefile generates by matching the gl* names
+   in this file against glad.c. Anything not in that list stays NULL, so
+   rebuild with make after using a new GL function. */
+#if defined(__has_include)
+#if __has_include("gl_used.gen.h")
+#define HAVE_GL_USED_LIST
+#endif
+#endif
+
+bool minimal_gl_loader = true;
+int loader_bench_iterations = 0;
+
+/* Number of functions listed in gl_used.gen.h */
+const int gl_used_count = 0
+#ifdef HAVE_GL_USED_LIST
+#define GL_USED(name, type) + 1
+#include "gl_used.gen.h"
+#undef GL_USED
+#endif
+  ;
+
+/* Resolve the functions in gl_used.gen.h; returns how many were found */
+int loadUsedGL (GLADloadproc load)
+{
+  int resolved = 0;
+#ifdef HAVE_GL_USED_LIST
+#define GL_USED(name, type) glad_##name = (type) load(#name); resolved += glad_##name != NULL;
+#include "gl_used.gen.h"
+#undef GL_USED
+#endif
+  return resolved;
+}
+
+void loadGL ()
+{
+#ifdef HAVE_GL_USED_LIST
+  if (minimal_gl_loader) {
+    // Every listed function must resolve, or a missing one would only show
+    // up as a NULL call later on
+    int resolved = loadUsedGL((GLADloadproc) glfwGetProcAddress);
+    if (resolved == gl_used_count && glGetString(GL_VERSION))
+      return;
+    fprintf(stderr, "Minimal GL loader resolved %d of %d functions, falling back to glad\n",
+            resolved, gl_used_count);
+  }
+#endif
+  if (!gladLoadGLLoader((GLADloadproc) glfwGetProcAddress)) {
+    fprintf(stderr, "Error: cannot load OpenGL functions\n");
+    exit(EXIT_FAILURE);
+  }
+}
+
+/* --loader-bench: time both loaders on the live context and exit */
+void benchmarkGLLoaders (int iterations)
+{
+  GLADloadproc load = (GLADloadproc) glfwGetProcAddress;
+  auto start = std::chrono::steady_clock::now();
+  int resolved = 0;
+  for (int i = 0; i < iterations; i++)
+    resolved = loadUsedGL(load);
+  auto middle = std::chrono::steady_clock::now();
+  for (int i = 0; i < iterations; i++)
+    gladLoadGLLoader(load);
+  auto end = std::chrono::steady_clock::now();
+
+  double minimal_us = std::chrono::duration<double, std::micro>(middle - start).count() / iterations;
+  double full_us = std::chrono::duration<double, std::micro>(end - middle).count() / iterations;
+  printf("gladLoadGLLoader: %.1f us per load\n", full_us);
+  printf("minimal loader  : %.1f us per load (%d functions)\n", minimal_us, resolved);
+  printf("saving          : %.1f us (%.0f%%)\n", full_us - minimal_us,
+         full_us > 0 ? 100 * (full_us - minimal_us) / full_us : 0.0);
 }
 
 /* Initialise glfw window, I/O callbacks and the renderer to use */
@@ -885,8 +3832,11 @@ GLFWwindow* initGLFW (int width, int height)
     GLFWwindow* window; // window desciptor/handle
 
     glfwSetErrorCallback(error_callback);
-    if (!glfwInit()) {
-      exit(EXIT_FAILURE);
+    {
+      PhaseTimer timer("glfwInit");
+      if (!glfwInit()) {
+        exit(EXIT_FAILURE);
+      }
     }
 
     glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
@@ -894,7 +3844,10 @@ GLFWwindow* initGLFW (int width, int height)
     glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
 
-    window = glfwCreateWindow(width, height, "Sample OpenGL 3.3 Application", NULL, NULL);
+    {
+      PhaseTimer timer("glfwCreateWindow");
+      window = glfwCreateWindow(width, height, "Sample OpenGL 3.3 Application", NULL, NULL);
+    }
 
     if (!window) {
       glfwTerminate();
@@ -902,16 +3855,24 @@ GLFWwindow* initGLFW (int width, int height)
     }
 
     glfwMakeContextCurrent(window);
-    gladLoadGLLoader((GLADloadproc) glfwGetProcAddress);
-    glfwSwapInterval( 1 );
+    if (loader_bench_iterations) {
+      benchmarkGLLoaders(loader_bench_iterations);
+      quit(window);
+    }
+    {
+      PhaseTimer timer(minimal_gl_loader ? "minimalGLLoader" : "gladLoadGLLoader");
+      loadGL();
+    }
+    applyPacing();
 
     /* --- register callbacks with GLFW --- */
 
     /* Register function to handle window resizes */
     /* With Retina display on Mac OS X GLFW's FramebufferSize
      is different from WindowSize */
+    /* Only the framebuffer callback: the window size one fired reshapeWindow
+       a second time for every resize */
     glfwSetFramebufferSizeCallback(window, reshapeWindow);
-    glfwSetWindowSizeCallback(window, reshapeWindow);
 
     /* Register function to handle window close */
     glfwSetWindowCloseCallback(window, quit);
@@ -926,22 +3887,81 @@ GLFWwindow* initGLFW (int width, int height)
     return window;
   }
 
+/* Look up the uniforms of the main program, again after every reload */
+void bindMainProgram (GLuint program)
+{
+  Matrices.MatrixID = glGetUniformLocation(program, "MVP");
+}
+
+void bindDiscProgram (GLuint program)
+{
+  disc_mvp_id = glGetUniformLocation(program, "MVP");
+  disc_size_id = glGetUniformLocation(program, "pointSize");
+}
+
 /* Initialize the OpenGL rendering properties */
 /* Add all the models to be created here */
   void initGL (GLFWwindow* window, int width, int height)
   {
-    /* Objects should be created before any other gl function and shaders */
+	// Submit every GLSL program first so the driver compiles them while we
+	// build the models, then collect them
+  ProgramBuild main_build, disc_build, board_build;
+  if (level_pack.header)
+    vertex_pulling = false;
+  {
+    PhaseTimer timer("LoadShaders submit");
+    MemoryScope memory_scope(MEM_SHADERS);
+    enableParallelShaderCompile();
+    submitShaders(main_build, "Sample_GL.vert", "Sample_GL.frag");
+    submitShaders(disc_build, "Disc.vert", "Disc.frag");
+    if (vertex_pulling)
+      submitShaders(board_build, "Pulled.vert", "Sample_GL.frag");
+    else
+      submitShaders(board_build, "Board.vert", "Sample_GL.frag");
+  }
+
 	// Create the models
-	createSquare (); // Generate the VAO, VBOs, vertices data & copy into the array buffer
-	createCuboid ();
-  createBorder ();
-  createCircle ();
-  createLine ();
-
-	// Create and compile our GLSL program from the shaders
-  programID = LoadShaders( "Sample_GL.vert", "Sample_GL.frag" );
+  {
+  MemoryScope memory_scope(MEM_GEOMETRY);
+  if (level_pack.header) { PhaseTimer timer("uploadPackMeshes"); uploadPackMeshes (); }
+  if (!triangle) { PhaseTimer timer("createSquare"); createSquare (); } // Generate the VAO, VBOs, vertices data & copy into the array buffer
+  if (!rectangle) { PhaseTimer timer("createCuboid"); createCuboid (); }
+  if (!border) { PhaseTimer timer("createBorder"); createBorder (); }
+  if (!circle) { PhaseTimer timer("createCircle"); createCircle (); }
+  { PhaseTimer timer("createCircleLods"); createCircleLods (); }
+  if (!line) { PhaseTimer timer("createLine"); createLine (); }
+  }
+  {
+  MemoryScope memory_scope(MEM_BOARD);
+  createEntities (triangle, rectangle, circle);
+  buildBorderModels ();
+  buildScene ();
+  if (vertex_pulling) { PhaseTimer timer("createPulledGeometry"); createPulledGeometry (); }
+  else { PhaseTimer timer("createBoardTexture"); createBoardTexture (); }
+  }
+
+  {
+    PhaseTimer timer("LoadShaders finish");
+    MemoryScope memory_scope(MEM_SHADERS);
+    main_program = gpuAdopt(GPU_PROGRAM, finishProgram(main_build));
+    disc_program = gpuAdopt(GPU_PROGRAM, finishProgram(disc_build));
+    if (vertex_pulling)
+      pull_program = gpuAdopt(GPU_PROGRAM, finishProgram(board_build));
+    else
+      board_program = gpuAdopt(GPU_PROGRAM, finishProgram(board_build));
+  }
 	// Get a handle for our "MVP" uniform
-  Matrices.MatrixID = glGetUniformLocation(programID, "MVP");
+  bindMainProgram(gpuName(main_program));
+  watchProgram(&main_program, "Sample_GL.vert", "Sample_GL.frag", bindMainProgram);
+  bindDiscProgram(gpuName(disc_program));
+  watchProgram(&disc_program, "Disc.vert", "Disc.frag", bindDiscProgram);
+  if (vertex_pulling) {
+    bindPulledProgram(gpuName(pull_program));
+    watchProgram(&pull_program, "Pulled.vert", "Sample_GL.frag", bindPulledProgram);
+  } else {
+    bindBoardProgram(gpuName(board_program));
+    watchProgram(&board_program, "Board.vert", "Sample_GL.frag", bindBoardProgram);
+  }
 
 
   reshapeWindow (window, width, height);
@@ -953,6 +3973,7 @@ GLFWwindow* initGLFW (int width, int height)
 
 	glEnable (GL_DEPTH_TEST);
 	glDepthFunc (GL_LEQUAL);
+	glEnable (GL_PROGRAM_POINT_SIZE); // Disc.vert sets gl_PointSize
 
   std::cout << "VENDOR: " << glGetString(GL_VENDOR) << std::endl;
   std::cout << "RENDERER: " << glGetString(GL_RENDERER) << std::endl;
@@ -965,24 +3986,179 @@ int main (int argc, char** argv)
 	int width = 1280;
 	int height = 720;
 
+  // --playout runs the headless board statistics and never opens a window
+  PlayoutConfig playout;
+  if (parsePlayoutArgs(argc, argv, playout))
+    return runPlayouts(playout);
+
+  // --transform-bench [N] compares the batch transform kernels with glm
+  for (int i = 1; i < argc; i++)
+    if (!strcmp(argv[i], "--transform-bench"))
+      return benchmarkTransforms(i + 1 < argc && isdigit((unsigned char)argv[i + 1][0]) ? std::max(1, atoi(argv[i + 1])) : 100000);
+
+  // --write-pack FILE [--pack-boards N] writes a level pack and exits,
+  // using --holes and --seed for the boards; --level-pack FILE plays one
+  const char *write_pack = NULL, *level_pack_path = NULL;
+  uint32_t pack_boards = 1000;
+  for (int i = 1; i + 1 < argc; i++) {
+    if (!strcmp(argv[i], "--write-pack"))
+      write_pack = argv[++i];
+    else if (!strcmp(argv[i], "--pack-boards"))
+      pack_boards = (uint32_t) std::max(0, atoi(argv[++i]));
+    else if (!strcmp(argv[i], "--level-pack"))
+      level_pack_path = argv[++i];
+  }
+  if (write_pack)
+    return writeLevelPack(write_pack, pack_boards, playout.holes[0], playout.seed) ? EXIT_SUCCESS : EXIT_FAILURE;
+  if (level_pack_path && !openLevelPack(level_pack_path))
+    exit(EXIT_FAILURE);
+
+  // --single-thread runs the simulation inline in the render loop
+  // --no-shader-cache always compiles shaders from source
+  // --shader-dir DIR reads shaders from DIR instead of the embedded copies
+  // --gl-loader full uses gladLoadGLLoader instead of the minimal loader
+  // --loader-bench [N] compares the two loaders and exits
+  // --startup-report[=FILE] writes startup phase timings as JSON
+  // --no-vertex-pulling draws the board from meshes instead of Pulled.vert
+  // --bench-frames N [--bench-json FILE] times N frames, reports and exits
+  // --check-frame-allocs fails the benchmark if steady state draw() allocates
+  // --pacing vsync|adaptive|uncapped|limit:FPS picks how frames are paced
+  bool threaded = true;
+  shader_dir = getenv("SHADER_DIR");
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "--single-thread"))
+      threaded = false;
+    else if (!strcmp(argv[i], "--no-shader-cache"))
+      shader_cache_enabled = false;
+    else if (!strcmp(argv[i], "--shader-dir") && i + 1 < argc)
+      shader_dir = argv[++i];
+    else if (!strcmp(argv[i], "--gl-loader") && i + 1 < argc)
+      minimal_gl_loader = strcmp(argv[++i], "full") != 0;
+    else if (!strcmp(argv[i], "--startup-report"))
+      startup_report_path = "-";
+    else if (!strncmp(argv[i], "--startup-report=", 17))
+      startup_report_path = argv[i] + 17;
+    else if (!strcmp(argv[i], "--no-vertex-pulling"))
+      vertex_pulling = false;
+    else if (!strcmp(argv[i], "--bench-frames") && i + 1 < argc)
+      bench_frames = std::max(1, atoi(argv[++i]));
+    else if (!strcmp(argv[i], "--bench-json") && i + 1 < argc)
+      bench_json_path = argv[++i];
+    else if (!strcmp(argv[i], "--check-frame-allocs"))
+      check_frame_allocs = true;
+    else if (!strcmp(argv[i], "--pacing") && i + 1 < argc) {
+      if (!parsePacing(argv[++i])) {
+        fprintf(stderr, "Unknown --pacing %s (vsync, adaptive, uncapped or limit:FPS)\n", argv[i]);
+        exit(EXIT_FAILURE);
+      }
+    }
+    else if (!strcmp(argv[i], "--loader-bench")) {
+      loader_bench_iterations = 100;
+      if (i + 1 < argc && isdigit((unsigned char)argv[i + 1][0]))
+        loader_bench_iterations = std::max(1, atoi(argv[++i]));
+    }
+  }
+
+  // Benchmarks measure the game, not the display's refresh rate
+  if (bench_frames && !pacer.mode_set)
+    pacer.mode = PACING_UNCAPPED;
+
   GLFWwindow* window = initGLFW(width, height);
 
-  initGL (window, width, height);
+  {
+    PhaseTimer timer("initGL");
+    initGL (window, width, height);
+  }
+  bool first_frame = true;
+  double first_frame_start = sinceProcessStart();
 
   double last_update_time = glfwGetTime(), current_time;
+  double previous_time = last_update_time, accumulator = 0;
+
+  // Make sure there is a complete snapshot before the first frame
+  tick();
+  publishSnapshot(last_update_time);
+  snapshots.update();
+  if (threaded)
+    startSimulation();
+  if (shader_dir)
+    startShaderWatcher();
+
+  long frame_count = 0;
+  double frame_start = glfwGetTime();
+  int exit_status = EXIT_SUCCESS;
 
     /* Draw in loop */
   while (!glfwWindowShouldClose(window)) {
 
-        // OpenGL Draw commands
-    draw();
+    double now = glfwGetTime();
+    beginMemoryFrame();
+    if (bench_frames && frame_count > BENCH_WARMUP_FRAMES)
+      bench_frame_ms.push_back(1000 * (now - frame_start));
+    if (bench_frames && frame_count == BENCH_WARMUP_FRAMES)
+      startBenchmark();
+    if (bench_frames && (long) bench_frame_ms.size() == bench_frames) {
+      writeBenchReport();
+      if (check_frame_allocs && steady_draw_allocations) {
+        fprintf(stderr, "Benchmark failed: draw() allocated %llu times in %ld steady state frames\n",
+                (unsigned long long) steady_draw_allocations, steady_allocating_frames);
+        exit_status = EXIT_FAILURE;
+      }
+      break;
+    }
+    frame_start = now;
+    frame_count++;
+    if (!threaded) {
+        // Run as many fixed simulation steps as the elapsed time calls for
+      double frame_time = std::min(now - previous_time, MAX_FRAME_TIME);
+      previous_time = now;
+      accumulator += frame_time;
+      while (accumulator >= SIM_DT) {
+        tick();
+        accumulator -= SIM_DT;
+        publishSnapshot(now - accumulator);
+      }
+    }
+
+        // Swap in edited shaders at the frame boundary
+    applyShaderReloads();
+
+        // OpenGL Draw commands, interpolated between the last two ticks
+    snapshots.update();
+    const GameSnapshot &snap = snapshots.readSlot();
+    float alpha = (float)((now - snap.tick_time) / SIM_DT);
+    draw_allocations = 0;
+    counting_draw_allocations = check_frame_allocs;
+    draw(snap, std::min(std::max(alpha, 0.0f), 1.0f));
+    counting_draw_allocations = false;
+    if (draw_allocations && frame_count > BENCH_WARMUP_FRAMES) {
+      if (!steady_allocating_frames)
+        fprintf(stderr, "draw() allocated %llu times in frame %ld\n", (unsigned long long) draw_allocations, frame_count);
+      steady_draw_allocations += draw_allocations;
+      steady_allocating_frames++;
+    }
 
         // Swap Frame Buffer in double buffering
     glfwSwapBuffers(window);
+    pacer.record(glfwGetTime());
+    if (first_frame) {
+      first_frame = false;
+      if (startup_report_path) {
+        glFinish(); // count the first frame as presented only once the GPU is done with it
+        StartupPhase phase = { "first frame", first_frame_start, sinceProcessStart() };
+        startup_phases.push_back(phase);
+        writeStartupReport(phase.end);
+      }
+    }
 
-        // Poll for Keyboard and mouse events
+        // Wait out the rest of the frame, then poll for Keyboard and mouse events
+    if (pacer.mode == PACING_LIMIT)
+      pacer.limit();
     glfwPollEvents();
 
+        // Drop this frame's transient data
+    frame_arena.reset();
+
         // Control based on time (Time based transformation like 5 degrees rotation every 0.5s)
         current_time = glfwGetTime(); // Time in seconds
         if ((current_time - last_update_time) >= 0.5) { // atleast 0.5s elapsed since last frame
@@ -991,6 +4167,12 @@ int main (int argc, char** argv)
         }
       }
 
+      stopShaderWatcher();
+      stopSimulation();
+      reportInputLatency();
+      reportPacing();
+      releaseGpuResources();
       glfwTerminate();
-      exit(EXIT_SUCCESS);
+      closeLevelPack();
+      exit(exit_status);
     }